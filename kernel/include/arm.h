@@ -11,6 +11,8 @@
 
 #define intrinsic __attribute__( ( always_inline ) ) static inline
 
+#define EXC_RETURN_STD_FRAME (1 << 4) /**< EXC_RETURN bit cleared when the exception frame includes fpu state */
+
 #include <unistd.h>
 
 void init_349( void );
@@ -46,6 +48,30 @@ intrinsic uint32_t load_exclusive_register( uint32_t *addr ) {
   return( result );
 }
 
+/**
+ * @brief      Asm wrapper for clz.
+ *
+ * @param[in]  val   Value to count the leading zeros of.
+ *
+ * @return     Number of leading zero bits in val, 32 if val is 0.
+ */
+intrinsic uint32_t count_leading_zeros( uint32_t val ) {
+  uint32_t result;
+
+  __asm volatile ( "clz %0, %1" : "=r" ( result ) : "r" ( val ) );
+  return( result );
+}
+
+/**
+ * @brief      Reads the DWT cycle counter. Only counts once
+ *             enable_cycle_counter() has been called.
+ *
+ * @return     Current processor cycle count.
+ */
+intrinsic uint32_t read_cycle_counter( void ) {
+  return *( ( volatile uint32_t * ) 0xE0001004 );
+}
+
 /**
  * @brief      Enables the interrupts.
  */
@@ -127,6 +153,8 @@ void clear_pendsv( void );
 
 int get_svc_status( void );
 
+void enable_cycle_counter( void );
+
 void set_svc_status( int status );
 
 #undef intrinsic
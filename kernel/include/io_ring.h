@@ -0,0 +1,57 @@
+/** @file io_ring.h
+ *
+ *  @brief  Layout of the asynchronous I/O rings shared by a thread and the
+ *          kernel. The thread posts requests on the submission ring and
+ *          keeps running. The kernel moves the bytes as the uart frees or
+ *          fills its buffers, from its interrupt handler, and posts one
+ *          completion per request for the thread to reap later.
+ *
+ *          Each ring serves one file, stdout for writes or stdin for reads,
+ *          and runs its requests in order. Ring indices run freely and are
+ *          masked on use. Only the thread advances sq_tail and cq_head, only
+ *          the kernel sq_head and cq_tail.
+ */
+
+#ifndef _IO_RING_H_
+#define _IO_RING_H_
+
+#include <stdint.h>
+
+/** @brief Entries in each of the two rings. A power of two */
+#define IO_RING_ENTRIES 8
+/** @brief Mask of a ring index */
+#define IO_RING_MASK ( IO_RING_ENTRIES - 1 )
+
+/**
+ * @struct io_sqe_t
+ * @brief  Submission, one read or write request.
+ */
+typedef struct {
+  uint32_t buf; /**< Buffer to write from or read into*/
+  uint32_t len; /**< Bytes to write, or the most to read*/
+  uint32_t tag; /**< Returned with the completion*/
+} io_sqe_t;
+
+/**
+ * @struct io_cqe_t
+ * @brief  Completion of one request.
+ */
+typedef struct {
+  uint32_t tag; /**< Tag of the request*/
+  int32_t result; /**< Bytes moved. A canonical mode read stops early at a newline. -1 if the thread cannot access the buffer*/
+} io_cqe_t;
+
+/**
+ * @struct io_ring_t
+ * @brief  A submission and a completion ring. Lives in user memory.
+ */
+typedef struct {
+  volatile uint32_t sq_head; /**< Next request the kernel takes*/
+  volatile uint32_t sq_tail; /**< Next free request entry*/
+  volatile uint32_t cq_head; /**< Next completion to reap*/
+  volatile uint32_t cq_tail; /**< Next free completion entry*/
+  io_sqe_t sq[IO_RING_ENTRIES]; /**< Submission ring*/
+  io_cqe_t cq[IO_RING_ENTRIES]; /**< Completion ring*/
+} io_ring_t;
+
+#endif /* _IO_RING_H_ */
@@ -8,13 +8,14 @@
 #define RBUF_SIZE (sizeof(rbuf_t))
 
 /*
-Ring buffer defn.
-size, head, tail declared volatile due to concurrency of user-space/kernel-space interrupt handler
+Ring buffer defn. Single producer, single consumer.
+head is only written by the producer and tail only by the consumer, so neither needs interrupts masked against the other.
+Both run freely and are masked on use, head - tail is the number of elements. size must be a power of two.
 */
 
 typedef struct {
     volatile uint32_t size;
-    volatile uint32_t n_elems;
+    volatile uint32_t mask;
     volatile uint32_t head;
     volatile uint32_t tail;
     //char payload[0];
@@ -26,5 +27,9 @@ typedef struct {
 extern void kernel_buffer_init(rbuf_t *buffer, unsigned init_size, volatile char *payload);
 extern int put(rbuf_t *buffer, char c);
 extern char poll(rbuf_t *buffer, int *err);
+extern uint32_t put_n(rbuf_t *buffer, const char *src, uint32_t n);
+extern uint32_t get_n(rbuf_t *buffer, char *dst, uint32_t n);
+extern uint32_t rbuf_count(rbuf_t *buffer);
+extern uint32_t rbuf_space(rbuf_t *buffer);
 extern void flush(rbuf_t *buffer);
 
@@ -0,0 +1,36 @@
+/** @file kernel_shared.h
+ *
+ *  @brief  Kernel page mapped read only into user space. The kernel keeps
+ *          the time and the running thread current in it, so user space
+ *          can query them without a system call, much like a vDSO.
+ */
+
+#ifndef _KERNEL_SHARED_H_
+#define _KERNEL_SHARED_H_
+
+#include <stdint.h>
+
+#ifndef MAX_U_THREADS
+#error "MAX_U_THREADS must be set, see the MAX_THREADS make variable"
+#endif
+
+/** @brief Bytes the linker script reserves for the page at __k_shared_low. A power of two so one MPU region covers it */
+#define KERNEL_SHARED_SIZE 1024
+
+/**
+ * @struct kshared_t
+ * @brief  Layout of the shared page. Only the kernel writes it.
+ */
+typedef struct {
+  volatile uint32_t sys_tick_ct; /**< Ticks since the scheduler started*/
+  volatile uint32_t running_thread; /**< Tcb_buffer idx of the running thread*/
+  volatile uint32_t thread_time[MAX_U_THREADS + 2]; /**< Cpu ticks consumed by each thread, idle and default threads last*/
+} kshared_t;
+
+/** @brief Start of the page, placed by the linker script */
+extern char __k_shared_low;
+
+/** @brief The shared page */
+#define KERNEL_SHARED ((volatile kshared_t *)&__k_shared_low)
+
+#endif /* _KERNEL_SHARED_H_ */
@@ -11,6 +11,15 @@
 
 #include <unistd.h>
 
+/**
+ * @struct mpu_region_t
+ * @brief  Prebuilt register values of one MPU region.
+ */
+typedef struct {
+  uint32_t rbar; /**< RBAR value, with the valid bit and region number set*/
+  uint32_t rasr; /**< RASR value*/
+} mpu_region_t;
+
 /**
  * @brief  Returns ceiling (log_2 n).
  */
@@ -20,14 +29,19 @@ void mm_enable_mpu(int enable);
 
 int mm_enable_user_access();
 
-int mm_enable_user_stacks(void *process_stack, void *kernel_stack, int thread_num);
+int mm_build_user_stacks(volatile mpu_region_t *regions, int thread_num);
+void mm_load_user_stacks(const volatile mpu_region_t *regions);
+
+int mm_user_can_access(const volatile mpu_region_t *stacks, const void *ptr, uint32_t len, int write);
 
 void mm_disable_user_access();
 
 void mm_disable_user_stacks();
 
 void mm_region_disable(uint32_t region_number);
+void mm_region_disable_subregions(uint32_t region_number, uint8_t subregions);
 
 int mm_region_enable(uint32_t region_number, void *base_address, uint8_t size_log2, int execute, int user_write_access);
+int mm_region_build(mpu_region_t *region, uint32_t region_number, void *base_address, uint8_t size_log2, int execute, int user_write_access);
 
 #endif /* _MPU_H_ */
@@ -0,0 +1,49 @@
+/** @file mutex_fast.h
+ *
+ *  @brief  Lock word layout and kernel published state shared by the kernel
+ *          and the user space mutex fast path.
+ *
+ *          A mutex whose ceiling equals the locking thread's priority adds no
+ *          ceiling effects while its holder runs, so it is taken and released
+ *          with LDREX/STREX on its lock word without entering the kernel. The
+ *          kernel adopts such locks into its own bookkeeping whenever their
+ *          holder enters it to lock or leaves the cpu, which is the only time
+ *          another thread could see them.
+ */
+
+#ifndef _MUTEX_FAST_H_
+#define _MUTEX_FAST_H_
+
+#include <stdint.h>
+
+#ifndef MAX_U_THREADS
+#error "MAX_U_THREADS must be set, see the MAX_THREADS make variable"
+#endif
+
+#ifndef MAX_MUTEXES
+#define MAX_MUTEXES 32 /**< Size of the kernel mutex pool. Set at build time with MAX_MUTEXES*/
+#endif
+
+/**
+ * @brief      Lock word values.
+ */
+//@{
+#define LOCK_FREE 0 /**< Lock word of a free mutex*/
+#define LOCK_KERNEL 0x80000000 /**< Set while the kernel tracks the mutex, lock and unlock then go through the SVC*/
+#define LOCK_OWNER(t) ((t) + 1) /**< Lock word of a mutex held by tcb_buffer idx t*/
+//@}
+
+/** @brief Fast_prio value no mutex ceiling matches, so every lock goes through the kernel */
+#define FAST_PRIO_NONE 0xFFFFFFFF
+
+/**
+ * @struct mutex_fast_t
+ * @brief  State the kernel publishes to the fast path. Lives in user memory.
+ */
+typedef struct {
+  volatile uint32_t running_thread; /**< Tcb_buffer idx of the running thread, written by the kernel on every dispatch*/
+  volatile uint32_t fast_prio; /**< Ceiling of the mutexes the running thread may lock in user space. Its priority while the system ceiling lets it lock, FAST_PRIO_NONE otherwise*/
+  volatile uint32_t held[MAX_U_THREADS + 2]; /**< Fast path locks held by each thread. Raised before a lock word names the thread so the kernel never misses one*/
+} mutex_fast_t;
+
+#endif /* _MUTEX_FAST_H_ */
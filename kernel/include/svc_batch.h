@@ -0,0 +1,26 @@
+/** @file svc_batch.h
+ *
+ *  @brief  Operation descriptors of a syscall batch, shared by the kernel
+ *          and user space. A batch runs several system calls in order for
+ *          the cost of one kernel entry.
+ */
+
+#ifndef _SVC_BATCH_H_
+#define _SVC_BATCH_H_
+
+#include <stdint.h>
+
+/** @brief Arguments an operation can pass, as many as any system call takes */
+#define SVC_OP_ARGS 5
+
+/**
+ * @struct svc_op_t
+ * @brief  One system call of a batch.
+ */
+typedef struct {
+  uint32_t svc; /**< Svc number of the call, see svc_num.h*/
+  uint32_t args[SVC_OP_ARGS]; /**< Arguments in the order the call takes them*/
+  int32_t result; /**< Return value, written once the call completes*/
+} svc_op_t;
+
+#endif /* _SVC_BATCH_H_ */
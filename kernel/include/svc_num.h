@@ -10,6 +10,12 @@
 #ifndef _SVC_NUM_H_
 #define _SVC_NUM_H_
 
+/**
+ * @brief Svc immediate reserved for v2 abi syscalls, which carry the svc
+ *        number in r12. No syscall may use it as its own number.
+ */
+#define SVC_ABI2 0xFF
+
 /** @brief SVC number for sbrk() */
 #define SVC_SBRK    0
 /** @brief SVC number for write() */
@@ -52,5 +58,55 @@
 #define SVC_SERVO_ENABLE   22
 /** @brief SVC number for servo_set() */
 #define SVC_SERVO_SET      23
+/** @brief SVC number for semaphore_init() */
+#define SVC_SEM_INIT    24
+/** @brief SVC number for semaphore_take() */
+#define SVC_SEM_TAKE    25
+/** @brief SVC number for semaphore_give() */
+#define SVC_SEM_GIVE    26
+/** @brief SVC number for event_group_init() */
+#define SVC_EVT_INIT    27
+/** @brief SVC number for event_group_set() */
+#define SVC_EVT_SET     28
+/** @brief SVC number for event_group_clear() */
+#define SVC_EVT_CLEAR   29
+/** @brief SVC number for event_group_wait() */
+#define SVC_EVT_WAIT    30
+/** @brief SVC number for queue_init() */
+#define SVC_Q_INIT      31
+/** @brief SVC number for queue_send() */
+#define SVC_Q_SEND      32
+/** @brief SVC number for queue_recv() */
+#define SVC_Q_RECV      33
+/** @brief SVC number for queue_alloc() */
+#define SVC_Q_ALLOC     34
+/** @brief SVC number for queue_send_slot() */
+#define SVC_Q_SEND_SLOT 35
+/** @brief SVC number for queue_recv_slot() */
+#define SVC_Q_RECV_SLOT 36
+/** @brief SVC number for queue_release() */
+#define SVC_Q_RELEASE   37
+/** @brief SVC number for rwlock_init() */
+#define SVC_RW_INIT     38
+/** @brief SVC number for rwlock_read_lock() */
+#define SVC_RW_RDLOCK   39
+/** @brief SVC number for rwlock_write_lock() */
+#define SVC_RW_WRLOCK   40
+/** @brief SVC number for rwlock_unlock() */
+#define SVC_RW_UNLOCK   41
+/** @brief SVC number for syscall_batch() */
+#define SVC_BATCH       42
+/** @brief SVC number for io_ring_init() */
+#define SVC_IO_INIT     43
+/** @brief SVC number for io_ring_submit() */
+#define SVC_IO_SUBMIT   44
+/** @brief SVC number for read_mode() */
+#define SVC_READ_MODE   45
+/** @brief SVC number for io_ring_exit() */
+#define SVC_IO_EXIT     46
+/** @brief SVC number for mutex_init() with a user space fast path */
+#define SVC_MUT_INIT_FAST 47
+/** @brief SVC number for bench_cycles() */
+#define SVC_BENCH_CYCLES 48
 
 #endif /* _SVC_NUM_H_ */
@@ -12,6 +12,8 @@
 #define _SYSCALLS_H_
 #define EOT 4
 
+#include <io_ring.h>
+
 /** @brief	Mapped to sbrk() sys call*/
 void *sys_sbrk(int incr);
 
@@ -21,9 +23,36 @@ int sys_write(int file, char *ptr, int len);
 /** @brief	Mapped to read() sys call*/
 int sys_read(int file, char *ptr, int len);
 
+/** @brief	Mapped to read_mode() sys call*/
+int sys_read_mode(int raw);
+
+/** @brief	Wakes readers whose input is ready */
+void read_rx_wake();
+
 /** @brief	Mapped to exit() sys call*/
 void sys_exit(int status);
 
+/** @brief	Mapped to io_ring_init() sys call*/
+int sys_io_ring_init(io_ring_t *ring, int file);
+
+/** @brief	Mapped to io_ring_submit() sys call*/
+int sys_io_ring_submit(io_ring_t *ring);
+
+/** @brief	Mapped to io_ring_exit() sys call*/
+int sys_io_ring_exit(io_ring_t *ring);
+
+/** @brief	Unregisters every io ring of a thread that is going away */
+void io_ring_drop(uint32_t buf_idx);
+
+/** @brief	Wakes writers blocked on a full uart transmit buffer */
+void write_tx_wake();
+
+/** @brief	Carries io ring writes on from the uart irq */
+void io_ring_pump_tx();
+
+/** @brief	Carries io ring reads on from the uart irq */
+void io_ring_pump_rx();
+
 /** @brief	Mapped to servo_enable() sys call*/
 int sys_servo_enable(uint8_t channel, uint8_t enabled);
 
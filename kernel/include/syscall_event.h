@@ -0,0 +1,84 @@
+/** @file syscall_event.h
+ *
+ *  @brief  Custom syscalls for event flag groups.
+ */
+
+#ifndef _SYSCALL_EVENT_H_
+#define _SYSCALL_EVENT_H_
+
+#include <unistd.h>
+#include "syscall_thread.h"
+
+#ifndef MAX_EVENT_GROUPS
+#define MAX_EVENT_GROUPS 8 /**< Maximum number of event groups the kernel can allocate*/
+#endif
+
+/**
+ * @brief      Options of sys_event_wait, OR'd together.
+ */
+//@{
+#define EVENT_WAIT_ANY 0 /**< Wake once any flag of the mask is set*/
+#define EVENT_WAIT_ALL 1 /**< Wake once every flag of the mask is set*/
+#define EVENT_CLEAR 2 /**< Clear the flags of the mask when the wait is satisfied*/
+//@}
+
+/**
+ * @brief      The struct for an event group.
+ */
+typedef struct {
+  volatile uint32_t flags; /**< Flag word*/
+  volatile uint32_t waiters[PRIO_WORDS]; /**< Priority bitmap of the threads blocked on this group, in the same layout as the ready bits*/
+} kevent_t;
+
+/**
+ * @brief      Used to create an event group with all flags clear. Like a
+ *             mutex, it resides in kernel space and the user receives a
+ *             handle to it.
+ *
+ * @return     A pointer to the event group. NULL if MAX_EVENT_GROUPS would
+ *             be exceeded.
+ */
+kevent_t *sys_event_init( void );
+
+/**
+ * @brief      Set flags of an event group
+ *
+ *             Wakes every thread whose wait is satisfied by the new flags.
+ *             Never blocks, so it may also be called from interrupt
+ *             handlers.
+ *
+ * @param[in]  event  The event group to act on.
+ * @param[in]  flags  Flags to set.
+ *
+ * @return     The flags after waking threads and clearing on their behalf.
+ */
+uint32_t sys_event_set( kevent_t *event, uint32_t flags );
+
+/**
+ * @brief      Clear flags of an event group
+ *
+ * @param[in]  event  The event group to act on.
+ * @param[in]  flags  Flags to clear.
+ *
+ * @return     The flags before clearing.
+ */
+uint32_t sys_event_clear( kevent_t *event, uint32_t flags );
+
+/**
+ * @brief      Wait on flags of an event group
+ *
+ *             Returns right away if the wait is already satisfied, otherwise
+ *             the current thread blocks until a set satisfies it.
+ *
+ * @param[in]  event    The event group to act on.
+ * @param[in]  mask     Flags to wait for.
+ * @param[in]  options  EVENT_WAIT_ANY or EVENT_WAIT_ALL, optionally OR'd
+ *                      with EVENT_CLEAR.
+ *
+ * @return     The flags that satisfied the wait, before any clearing. 0 if
+ *             the mask is empty, or the wait is unsatisfied and the caller
+ *             is the idle or default thread, which may not block.
+ */
+uint32_t sys_event_wait( kevent_t *event, uint32_t mask, uint32_t options );
+
+#endif /* _SYSCALL_EVENT_H_ */
@@ -11,16 +11,26 @@
 #define _SYSCALL_MUTEX_H_
 
 #include <unistd.h>
+#include "syscall_thread.h"
+#include "mutex_fast.h"
+
+#define MUTEX_INHERIT 0xFFFFFFFF /**< Max_prio of a mutex using priority inheritance instead of the priority ceiling protocol*/
 
 /**
- * @brief      The struct for a mutex.
+ * @brief      The struct for a mutex. A reader-writer lock is a mutex that
+ *             may also be locked for reading by several threads at once.
  */
 typedef struct {
-  volatile uint32_t locked_by; /**< TCB_buf index of locking thread*/
+  volatile uint32_t locked_by; /**< TCB_buf index of locking thread, the writer of a reader-writer lock*/
   volatile uint32_t prio_ceil;
-  volatile uint32_t max_prior; 
+  volatile uint32_t max_prior; /**< Ceiling while locked, the highest priority of any user. MUTEX_INHERIT if it has none*/
   // You may fill in additional fields in this struct if you require.
   volatile uint32_t mutex_num;
+  volatile uint32_t waiters[PRIO_WORDS]; /**< Priority bitmap of the threads blocked on this mutex, in the same layout as the ready bits*/
+  volatile uint32_t *lock_word; /**< User space lock word of the mutex, NULL if it has no fast path*/
+  volatile uint32_t read_ceil; /**< Ceiling while read locked, the highest priority of any writer. Max_prior for a plain mutex*/
+  volatile uint32_t reader_ct; /**< Number of threads holding a reader-writer lock for reading*/
+  volatile uint32_t readers[TCB_WORDS]; /**< Bitmap of the tcb_buffer idxs of those threads, bit (31 - idx%32) of word idx/32*/
 } kmutex_t;
 
 /**
@@ -29,25 +39,57 @@ typedef struct {
  *             protection, the user cannot modify it. However, the pointer
  *             can still be passed around and used with lock and unlock.
  *
- * @param      max_prio  The maximum priority of a thread which could use
- *                       this mutex (the lowest number, following convention).
+ * @param      max_prio   The maximum priority of a thread which could use
+ *                        this mutex (the lowest number, following convention).
+ *                        MUTEX_INHERIT if it is unknown, so the mutex uses
+ *                        priority inheritance and has no ceiling.
+ * @param      lock_word  User space lock word for the fast path, or NULL.
+ *                        Only SVC_MUT_INIT_FAST passes one, SVC_MUT_INIT
+ *                        keeps its one argument abi.
+ * @param      fast       User space block the kernel publishes fast path
+ *                        state to, or NULL.
  *
  * @return     A pointer to the mutex. NULL if max_mutexes would be exceeded.
  */
-kmutex_t *sys_mutex_init( uint32_t max_prio );
+kmutex_t *sys_mutex_init( uint32_t max_prio, volatile uint32_t *lock_word, mutex_fast_t *fast );
+
+/**
+ * @brief      Used to create a reader-writer lock. It is a mutex that
+ *             sys_rwlock_read_lock can also lock for several readers at
+ *             once. Sys_mutex_lock locks it for writing and sys_mutex_unlock
+ *             unlocks either way.
+ *
+ * @param      read_prio   The maximum priority of a thread which could read.
+ * @param      write_prio  The maximum priority of a thread which could write.
+ *
+ * @return     A pointer to the lock. NULL if max_mutexes would be exceeded.
+ */
+kmutex_t *sys_rwlock_init( uint32_t read_prio, uint32_t write_prio );
 
 /**
  * @brief      Lock a mutex
  *
  *             This function will not return until the current thread has
- *             obtained the mutex.
+ *             obtained the mutex. A reader-writer lock is obtained for
+ *             writing.
  *
  * @param[in]  mutex  The mutex to act on.
  */
 void sys_mutex_lock( kmutex_t *mutex );
 
 /**
- * @brief      Unlock a mutex
+ * @brief      Lock a reader-writer lock for reading
+ *
+ *             This function will not return until the current thread has
+ *             obtained the lock. Threads above every writer's priority
+ *             read concurrently.
+ *
+ * @param[in]  rwlock  The lock to act on.
+ */
+void sys_rwlock_read_lock( kmutex_t *rwlock );
+
+/**
+ * @brief      Unlock a mutex, or a reader-writer lock held either way
  *
  * @param[in]  mutex  The mutex to act on.
  */
@@ -0,0 +1,128 @@
+/** @file syscall_queue.h
+ *
+ *  @brief  Custom syscalls for bounded message queues.
+ */
+
+#ifndef _SYSCALL_QUEUE_H_
+#define _SYSCALL_QUEUE_H_
+
+#include <unistd.h>
+#include "syscall_thread.h"
+
+#ifndef MAX_QUEUES
+#define MAX_QUEUES 8 /**< Maximum number of message queues the kernel can allocate*/
+#endif
+
+#ifndef MAX_QUEUE_SLOTS
+#define MAX_QUEUE_SLOTS 32 /**< Maximum number of slots in one message queue*/
+#endif
+
+#if MAX_QUEUE_SLOTS > 255
+#error "MAX_QUEUE_SLOTS too large, slot indices are kept in bytes"
+#endif
+
+#define SLOT_FREE 0xFF /**< slot_held value of a slot no thread holds*/
+
+#if MAX_U_THREADS + 2 > SLOT_FREE
+#error "MAX_U_THREADS too large, slot holders are kept in bytes"
+#endif
+
+/**
+ * @brief      The struct for a message queue. Messages live in a pool of
+ *             fixed size slots supplied by the user. The kernel only moves
+ *             slot indices between a free stack and a FIFO of sent slots, so
+ *             slots can be handed to threads without copying.
+ */
+typedef struct {
+  char *slots; /**< Slot pool, slot_ct slots of slot_size bytes*/
+  uint32_t slot_size; /**< Size of a slot in bytes*/
+  uint32_t slot_ct; /**< Number of slots in the pool*/
+  volatile uint8_t free_slots[MAX_QUEUE_SLOTS]; /**< Stack of the slots nobody holds*/
+  volatile uint32_t free_ct; /**< Number of slots in free_slots*/
+  volatile uint8_t full_slots[MAX_QUEUE_SLOTS]; /**< Ring of the sent slots, oldest first*/
+  volatile uint32_t full_head; /**< Position of the oldest sent slot in full_slots*/
+  volatile uint32_t full_ct; /**< Number of slots in full_slots*/
+  volatile uint8_t slot_held[MAX_QUEUE_SLOTS]; /**< Tcb_buffer idx of the thread holding the slot, between alloc and send or recv and release. SLOT_FREE otherwise*/
+  volatile uint32_t send_waiters[PRIO_WORDS]; /**< Priority bitmap of the threads blocked waiting for a free slot*/
+  volatile uint32_t recv_waiters[PRIO_WORDS]; /**< Priority bitmap of the threads blocked waiting for a sent slot*/
+} kqueue_t;
+
+/**
+ * @brief      Used to create a message queue. Like a mutex, it resides in
+ *             kernel space and the user receives a handle to it.
+ *
+ * @param      slots      Slot pool of slot_ct * slot_size bytes.
+ * @param      slot_size  Size of each message in bytes.
+ * @param      slot_ct    Number of slots, at most MAX_QUEUE_SLOTS.
+ *
+ * @return     A pointer to the queue. NULL if the pool is invalid, not
+ *             writable by the caller, or MAX_QUEUES would be exceeded.
+ */
+kqueue_t *sys_queue_init( void *slots, uint32_t slot_size, uint32_t slot_ct );
+
+/**
+ * @brief      Copy a message into the queue, blocking while it is full.
+ *
+ * @param[in]  queue  The queue to act on.
+ * @param[in]  msg    Message of slot_size bytes.
+ *
+ * @return     0 on success, -1 if the queue or message is invalid or the
+ *             idle or default thread would block.
+ */
+int sys_queue_send( kqueue_t *queue, const void *msg );
+
+/**
+ * @brief      Copy the oldest message out of the queue, blocking while it
+ *             is empty.
+ *
+ * @param[in]  queue  The queue to act on.
+ * @param[out] msg    Buffer of slot_size bytes.
+ *
+ * @return     0 on success, -1 if the queue or buffer is invalid or the
+ *             idle or default thread would block.
+ */
+int sys_queue_recv( kqueue_t *queue, void *msg );
+
+/**
+ * @brief      Take a free slot to fill in place, blocking while none is
+ *             free. The slot is passed on with sys_queue_send_slot.
+ *
+ * @param[in]  queue  The queue to act on.
+ *
+ * @return     The slot, NULL if the queue is invalid or the idle or default
+ *             thread would block.
+ */
+void *sys_queue_alloc( kqueue_t *queue );
+
+/**
+ * @brief      Send a slot taken with sys_queue_alloc without copying it.
+ *
+ * @param[in]  queue  The queue to act on.
+ * @param[in]  slot   The slot.
+ *
+ * @return     0 on success, -1 if the slot is not one the caller holds.
+ */
+int sys_queue_send_slot( kqueue_t *queue, void *slot );
+
+/**
+ * @brief      Take the oldest sent slot to read in place, blocking while the
+ *             queue is empty. The slot is given back with sys_queue_release.
+ *
+ * @param[in]  queue  The queue to act on.
+ *
+ * @return     The slot, NULL if the queue is invalid or the idle or default
+ *             thread would block.
+ */
+void *sys_queue_recv_slot( kqueue_t *queue );
+
+/**
+ * @brief      Give back a slot taken with sys_queue_recv_slot.
+ *
+ * @param[in]  queue  The queue to act on.
+ * @param[in]  slot   The slot.
+ *
+ * @return     0 on success, -1 if the slot is not one the caller holds.
+ */
+int sys_queue_release( kqueue_t *queue, void *slot );
+
+#endif /* _SYSCALL_QUEUE_H_ */
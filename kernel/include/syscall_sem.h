@@ -0,0 +1,59 @@
+/** @file syscall_sem.h
+ *
+ *  @brief  Custom syscalls for counting semaphores.
+ */
+
+#ifndef _SYSCALL_SEM_H_
+#define _SYSCALL_SEM_H_
+
+#include <unistd.h>
+#include "syscall_thread.h"
+
+#ifndef MAX_SEMAPHORES
+#define MAX_SEMAPHORES 16 /**< Maximum number of semaphores the kernel can allocate*/
+#endif
+
+/**
+ * @brief      The struct for a counting semaphore.
+ */
+typedef struct {
+  volatile uint32_t count; /**< Number of takes that can succeed without blocking*/
+  volatile uint32_t waiters[PRIO_WORDS]; /**< Priority bitmap of the threads blocked on this semaphore, in the same layout as the ready bits*/
+} ksem_t;
+
+/**
+ * @brief      Used to create a semaphore object. Like a mutex, it resides in
+ *             kernel space and the user receives a handle to it.
+ *
+ * @param      count  Initial count of the semaphore.
+ *
+ * @return     A pointer to the semaphore. NULL if MAX_SEMAPHORES would be
+ *             exceeded.
+ */
+ksem_t *sys_sem_init( uint32_t count );
+
+/**
+ * @brief      Take a semaphore
+ *
+ *             Decrements the count. If it is 0, the current thread blocks
+ *             until a give hands it the count.
+ *
+ * @param[in]  sem  The semaphore to act on.
+ *
+ * @return     0 on success, -1 if the count is 0 and the caller is the idle
+ *             or default thread, which may not block.
+ */
+int sys_sem_take( ksem_t *sem );
+
+/**
+ * @brief      Give a semaphore
+ *
+ *             Wakes the highest priority thread blocked on the semaphore, or
+ *             increments the count if there is none. Never blocks, so it may
+ *             also be called from interrupt handlers.
+ *
+ * @param[in]  sem  The semaphore to act on.
+ */
+void sys_sem_give( ksem_t *sem );
+
+#endif /* _SYSCALL_SEM_H_ */
@@ -12,6 +12,7 @@
 #define _SYSCALL_THREAD_H_
 
 #include <unistd.h>
+#include "mpu.h"
 
 /**
  * @enum protection_mode
@@ -20,6 +21,32 @@
  */
 typedef enum { PER_THREAD = 1, KERNEL_ONLY = 0 } protection_mode;
 
+#define PROT_MODE_MASK 0x1 /**< Bits of the memory_protection argument to sys_thread_init holding the protection_mode*/
+
+/**
+ * @brief      Scheduling policies. OR'd into the memory_protection argument to sys_thread_init, PCP if none is given.
+ */
+//@{
+#define SCHED_PCP (0 << 4) /**< Fixed priorities with the priority ceiling protocol, admission by UB test*/
+#define SCHED_RMS (1 << 4) /**< Fixed priorities without ceiling checks, admission by UB test*/
+#define SCHED_EDF (2 << 4) /**< Earliest deadline first, admission while total utilization is at most 1*/
+#define SCHED_POLICY_MASK (3 << 4) /**< Bits of the memory_protection argument holding the policy*/
+//@}
+
+#define SCHED_RTA (1 << 6) /**< Admit fixed priority threads by exact response time analysis instead of the UB test*/
+
+#ifndef MAX_U_THREADS
+#define MAX_U_THREADS 14 /**< Maximum number of user allocated threads, which is also the number of user priorities. Set at build time with MAX_THREADS*/
+#endif
+
+#if MAX_U_THREADS > 125
+#error "MAX_U_THREADS too large, tcb indices are kept in signed chars"
+#endif
+
+#define MAX_TOTAL_THREADS (MAX_U_THREADS + 2) /**< Maximum total threads allowed by the system, user threads plus idle and default*/
+#define PRIO_WORDS ((MAX_U_THREADS + 31)/32) /**< Number of words in each priority bitmap*/
+#define TCB_WORDS ((MAX_TOTAL_THREADS + 31)/32) /**< Number of words in a bitmap with a bit per thread*/
+
 
 /**
  * @struct	Thread control block struct. 	
@@ -33,11 +60,19 @@ typedef struct {
   uint32_t T; /**< Thread execution period*/
   uint32_t duration; /**< Current execution elapsed time. */
   uint32_t total_time; /**< Total cpu time consumed over all executions. */
-  uint32_t period_ct; /**< Number of ticks into current period.*/
-  float U; /**< Thread utilization.*/
+  uint32_t next_release; /**< Absolute sys tick at which the thread's next period begins.*/
+  uint32_t U; /**< Thread utilization, Q16 fixed point.*/
   int svc_state; /**< Thread svc state. */
-  uint8_t blocked;
+  uint32_t wait_mutex; /**< Mutex id of the mutex the thread wants while BLOCKED. */
+  uint8_t wait_read; /**< Set if it wants wait_mutex for reading. */
+  uint32_t locks_held; /**< Number of mutexes the thread holds. */
+  uint32_t event_mask; /**< Flags the thread waits for while BLOCKED on an event group, the flags that woke it once RUNNABLE. */
+  uint8_t event_options; /**< Options of the thread's event group wait. */
+  uint32_t queue_slot; /**< Message queue slot handed to the thread when it was woken. */
+  uint32_t block_ct; /**< Times the thread was made to wait or block. A syscall batch stops once this changes. */
   uint8_t thread_state; /**< Thread current state. */
+  uint8_t fpu_used; /**< Set while the thread's saved context includes fpu registers. */
+  mpu_region_t stack_regions[2]; /**< Prebuilt user and kernel stack regions loaded when the thread is switched in. */
 }tcb_t;
 
 /**
@@ -78,6 +113,10 @@ typedef struct {
 typedef struct {
   signed char *wait_set; /**< Priority ordered mapping of threads which are waiting to their tcb's. 0 is highest priority. Must be disjoint with the ready set.*/
   signed char *ready_set; /**< Priority ordered mapping of threads which are ready for execution to their tcb's. 0 is highest priority. Must be disjoint with the waiting set. */
+  signed char *blocked_set; /**< Priority ordered mapping of threads blocked on a mutex to their tcb's. Disjoint with the ready and waiting sets.*/
+  uint32_t wait_bits[PRIO_WORDS]; /**< Priority bitmap of the wait set. Bit (31 - priority%32) of word priority/32 is set while wait_set[priority] holds a thread.*/
+  uint32_t ready_bits[PRIO_WORDS]; /**< Priority bitmap of the ready set. Bit (31 - priority%32) of word priority/32 is set while ready_set[priority] holds a thread, so clz gives the highest ready priority.*/
+  uint32_t blocked_bits[PRIO_WORDS]; /**< Priority bitmap of the blocked set.*/
   uint8_t running_thread; /**< Tbuf index of currently running thread*/
   uint32_t sys_tick_ct; /**< Used for time slicing and scheduling*/
   uint32_t stack_size; /**< Stack size per thread*/
@@ -85,14 +124,26 @@ typedef struct {
   uint32_t max_threads; /**< Maximum number of allocatable user threads. Determined by user at thread initialization */
   uint32_t max_mutexes;
   uint32_t u_mutex_ct;
+  uint32_t u_sem_ct; /**< Number of allocated semaphores*/
+  uint32_t u_event_ct; /**< Number of allocated event groups*/
+  uint32_t u_queue_ct; /**< Number of allocated message queues*/
   void *thread_u_stacks_bottom;
   void *thread_k_stacks_bottom;
   protection_mode mem_prot;
+  uint32_t sched_policy; /**< Scheduling policy, one of the SCHED_ values. Selected at thread initialization */
+  uint8_t rta_admission; /**< Set if SCHED_RTA was given at thread initialization */
   int32_t priority_ceiling;
 }k_threading_state_t;
 
 #define K_BLOCK_SIZE (sizeof(k_threading_state_t)) /**< sizeof(k_thread_state_t)*/
 
+/**
+ * @struct	Kernel wait queue, for threads blocked on a condition outside the synchronization primitives, such as a driver buffer.
+ */
+typedef struct {
+  volatile uint32_t waiters[PRIO_WORDS]; /**< Priority bitmap of the threads blocked on the queue*/
+}kwait_t;
+
 /**
  * @brief	Global threading state
  */ 
@@ -123,7 +174,8 @@ void *pendsv_c_handler( void * );
  *                                is supplied, the kernel will provide its
  *                                own idle function that will sleep.
  * @param[in]  memory_protection  Enum for memory protection, either
- *                                PER_THREAD or KERNEL_ONLY
+ *                                PER_THREAD or KERNEL_ONLY, OR'd with
+ *                                one of the SCHED_ policies.
  * @param[in]  max_mutexes        Maximum number of mutexes that will be
  *                                created.
  *
@@ -139,8 +191,8 @@ int sys_thread_init(
 
 /**
  * @brief      Create a new thread running the given function. The thread will
- *             not be created if the UB test fails, and in that case this function
- *             will return an error.
+ *             not be created if the admission test of the scheduling policy
+ *             fails, and in that case this function will return an error.
  *
  * @param[in]  fn     Pointer to the function to run in the new thread.
  * @param[in]  prio   Priority of this thread. Lower number are higher
@@ -201,12 +253,49 @@ void sys_wait_until_next_period( void );
 */
 void sys_thread_kill( void );
 
+/**
+* @brief      Clears the kernel page user space reads the time and running
+*             thread from, see kernel_shared.h.
+*/
+void shared_page_init( void );
+
+/**
+* @brief      Blocks the running thread on a wait queue unless done() says
+*             it need not wait. Returns -1 for the idle and default threads,
+*             which cannot block.
+*/
+int wait_queue_block(kwait_t *wq, int (*done)(void));
+
+/**
+* @brief      Wakes every thread blocked on a wait queue. Interrupt handlers
+*             may call it.
+*/
+void wait_queue_wake(kwait_t *wq);
+
+/**
+* @brief      Returns how often the running thread was made to wait or
+*             block so far.
+*/
+uint32_t get_block_ct( void );
+
+/**
+* @brief      Returns the tcb_buffer idx of the running thread.
+*/
+uint32_t get_running_thread( void );
+
+/**
+* @brief      Checks that a thread could access a range of memory itself,
+*             so the kernel may touch it on the thread's behalf. Interrupt
+*             handlers may call it.
+*/
+int thread_can_access(uint32_t buf_idx, const void *ptr, uint32_t len, int write);
+
 int check_no_locks(uint32_t n);
 
 void raise_blocking_priority(uint32_t curr_ceil);
 
-int acquire_mutex(uint32_t curr_ceil, uint32_t max_prior, uint8_t mutex_num);
-
 int32_t find_highest_locker();
 
+int32_t find_highest_locked();
+
 #endif /* _SYSCALL_THREAD_H_ */
@@ -11,11 +11,15 @@
 #ifndef _TIMER_H_
 #define _TIMER_H_
 
+#include <unistd.h>
+
 #define CPU_CLK_FREQ 0XF42400 /**< CPU clk frequency (16MHz) */
 #define SYS_TICK_BASE 0xE000E010 /**< Systick base address */
 #define COUNTER 1 /**Enable counter */
 #define PROC_CLK (1 << 2) /**< Utilize proc. clk for systick*/
 #define INTERRUPT (1 << 1) /**Enable inetrrupt*/
+#define COUNTFLAG (1 << 16) /**< Set when the counter wrapped since the last read of stk_ctrl */
+#define MAX_RELOAD 0xFFFFFF /**< Largest value the 24 bit reload register can hold */
 
 /** @brief	Start systick. */
 int timer_start(int frequency);
@@ -23,4 +27,10 @@ int timer_start(int frequency);
 /** @brief	Stop systick*/
 void timer_stop();
 
+/** @brief	Delay the next systick interrupt by a number of ticks. */
+uint32_t timer_stretch(uint32_t ticks);
+
+/** @brief	Return to firing every tick, reporting the ticks skipped. */
+uint32_t timer_unstretch();
+
 #endif /* _TIMER_H_ */
@@ -52,9 +52,27 @@ void uart_init(int baud);
 /** @brief	Put a single byte into the uart */
 int uart_put_byte(char c);
 
+/** @brief	Put a span of bytes into the uart */
+int uart_put_bytes(const char *ptr, int len);
+
+/** @brief	Free space in the uart transmit buffer */
+int uart_tx_space();
+
 /** @brief	Recieve a single byte from the uart */
 int uart_get_byte(char *c);
 
+/** @brief	Receive a span of bytes from the uart, raw mode only */
+int uart_get_bytes(char *ptr, int len);
+
+/** @brief	Check whether a read of want bytes can go ahead */
+int uart_rx_ready(int want);
+
+/** @brief	Select raw or canonical input */
+void uart_set_raw(int raw);
+
+/** @brief	Returns 1 in raw mode, 0 in canonical mode */
+int uart_get_raw();
+
 /** @brief	Flush the uart buffers */
 void uart_flush();
 
@@ -34,6 +34,18 @@
 #define SHPR2 ((volatile uint32_t *) 0xE000ED1C)
 /* @brief System handler priority register 3 */
 #define SHPR3 ((volatile uint32_t *) 0xE000ED20)
+/* @brief Debug exception and monitor control register and flags */
+//@{
+#define DEMCR ((volatile uint32_t *) 0xE000EDFC)
+#define DEMCR_TRCENA (1 << 24)
+//@}
+/* @brief DWT control register and flags */
+//@{
+#define DWT_CTRL ((volatile uint32_t *) 0xE0001000)
+#define DWT_CTRL_CYCCNTENA 1
+//@}
+/* @brief DWT cycle count register */
+#define DWT_CYCCNT ((volatile uint32_t *) 0xE0001004)
 /* @brief System handler control and state register and flags */
 //@{
 #define SHCSR ((volatile uint32_t *) 0xE000ED24)
@@ -112,3 +124,12 @@ void set_svc_status( int status ){
   if (status) *SHCSR |= SHCSR_SVCALLACT;
   else *SHCSR &= ~SHCSR_SVCALLACT;
 }
+
+/**
+ * @brief      Starts the DWT cycle counter from 0.
+ */
+void enable_cycle_counter( void ){
+  *DEMCR |= DEMCR_TRCENA;
+  *DWT_CYCCNT = 0;
+  *DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
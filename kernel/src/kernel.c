@@ -18,6 +18,7 @@
 #include <led_driver.h>
 #include <servok.h>
 #include <mpu.h>
+#include <syscall_thread.h>
 
 /**
 * Period of the sys_tick interrupt firing. Configured to allow manual pwm control of the servo. 
@@ -29,8 +30,15 @@
 */
 int kernel_main( void ) {
   init_349(); // DO NOT REMOVE THIS LINE
+#ifdef __ARM_FP
+  enable_fpu(); //Hard float build, fpu state is stacked lazily and switched only for threads using it
+#endif
   uart_init(USART_DIV);
+#ifdef BENCH
+  enable_cycle_counter(); //Times critical sections from the first write
+#endif
   led_driver_init();
+  shared_page_init();
   mm_enable_mpu(1);
   mm_enable_user_access();
   enter_user_mode();
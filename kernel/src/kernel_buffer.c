@@ -12,17 +12,39 @@
  * @brief	Initialize an rbuf_t. 
  
  * @param[in]	buffer	Allocated buffer which should be initialized with the correct values. 
- * @param[in]	init_size	Size of the desired buffer. Should match len(payload)
+ * @param[in]	init_size	Size of the desired buffer. Should match len(payload) and be a power of two. 
  * @param[in]	payload	(char*) Allocated memory to be used to story the rbuf_t payload. 
  */
 void kernel_buffer_init(rbuf_t *buffer, unsigned init_size, volatile char *payload){
    buffer->head = 0;
-   buffer->n_elems = 0;
    buffer->tail = 0;
    buffer->size = init_size;
+   buffer->mask = init_size - 1;
    buffer->payload = payload;
 }
 
+/**
+ * @brief	Number of chars in a buffer. 
+
+ * @param[in]	buffer	The buffer. 
+
+ * @return	Chars the consumer can take. 
+ */
+uint32_t rbuf_count(rbuf_t *buffer) {
+   return buffer->head - buffer->tail;
+}
+
+/**
+ * @brief	Free space in a buffer. 
+
+ * @param[in]	buffer	The buffer. 
+
+ * @return	Chars the producer can add. 
+ */
+uint32_t rbuf_space(rbuf_t *buffer) {
+   return buffer->size - (buffer->head - buffer->tail);
+}
+
 /**
  * @brief	Put a char in to a buffer. 
  
@@ -32,19 +54,15 @@ void kernel_buffer_init(rbuf_t *buffer, unsigned init_size, volatile char *paylo
  * @return	0 on success. -1 otherwise. 
  */
 int put(rbuf_t *buffer, char c) {
-   
+   uint32_t head = buffer->head;
+
    /* Check if buffer is full */
-   if(buffer->n_elems >= buffer->size) {
+   if(head - buffer->tail >= buffer->size) {
       return -1;
    }
 
-   buffer->payload[buffer->head++] = c;
-   buffer->n_elems++;  
-
-   /* End of buffer */
-   if(buffer->head >= buffer->size) {
-      buffer->head = 0;
-   }
+   buffer->payload[head & buffer->mask] = c;
+   buffer->head = head + 1; /* Published after the char so the consumer never sees it unwritten */
    return 0;
 }
 
@@ -57,24 +75,72 @@ int put(rbuf_t *buffer, char c) {
  * @return	retrieved cahr. 
  */
 char poll(rbuf_t *buffer, int *err) {
+   uint32_t tail = buffer->tail;
 
    /* Check if buffer is empty */
-   if(!(buffer->n_elems)) {
+   if(buffer->head == tail) {
       *err = 1;
       return (char)-1;
    }
    
-   char byte = buffer->payload[buffer->tail];
-   buffer->payload[buffer->tail] = 0;
-   buffer->tail++;
-   buffer->n_elems--;
-
-   /* If tail is over the bounds wrap back */
-   if(buffer->tail >= buffer->size) {
-      buffer->tail = 0;
-   }
+   char byte = buffer->payload[tail & buffer->mask];
+   buffer->tail = tail + 1; /* Released after the char is read so the producer cannot overwrite it first */
 
    *err = 0;
    return byte;
 }
 
+/**
+ * @brief	Put as many chars of a span into a buffer as fit. Copies up to the end of the payload, then wraps to its start. 
+ 
+ * @param[in]	buffer	The buffer which the chars should be added to. 
+ * @param[in]	src	Chars to add. 
+ * @param[in]	n	Number of chars in src. 
+
+ * @return	Number of chars added, less than n if the buffer filled. 
+ */
+uint32_t put_n(rbuf_t *buffer, const char *src, uint32_t n) {
+   uint32_t head = buffer->head;
+   uint32_t space = buffer->size - (head - buffer->tail);
+   if(n > space) n = space;
+
+   uint32_t start = head & buffer->mask;
+   uint32_t first = buffer->size - start;
+   if(first > n) first = n;
+
+   for(uint32_t i = 0; i < first; i++) 
+      buffer->payload[start + i] = src[i];
+   for(uint32_t i = first; i < n; i++) 
+      buffer->payload[i - first] = src[i];
+
+   buffer->head = head + n;
+   return n;
+}
+
+/** 
+ * @brief	Take as many chars out of a buffer as are there, up to n. Copies up to the end of the payload, then wraps to its start. 
+
+ * @param[in]	buffer	The buffer to take from.
+ * @param[out]	dst	Where the chars are copied to. 
+ * @param[in]	n	Most chars to take. 
+
+ * @return	Number of chars taken, less than n if the buffer emptied. 
+ */
+uint32_t get_n(rbuf_t *buffer, char *dst, uint32_t n) {
+   uint32_t tail = buffer->tail;
+   uint32_t count = buffer->head - tail;
+   if(n > count) n = count;
+
+   uint32_t start = tail & buffer->mask;
+   uint32_t first = buffer->size - start;
+   if(first > n) first = n;
+
+   for(uint32_t i = 0; i < first; i++) 
+      dst[i] = buffer->payload[start + i];
+   for(uint32_t i = first; i < n; i++) 
+      dst[i] = buffer->payload[i - first];
+
+   buffer->tail = tail + n;
+   return n;
+}
+
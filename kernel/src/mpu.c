@@ -14,6 +14,7 @@
 #include "syscall.h"
 #include "mpu.h"
 #include "syscall_thread.h"
+#include "kernel_shared.h"
 
 /**Compiler macro used to indicate arguments which should be temporarily ignored as they are unused*/
 #define UNUSED __attribute__((unused))
@@ -92,6 +93,7 @@ typedef struct {
 #define RASR_AP_KERN ( 1<<26 )
 #define RASR_AP_USER ( 1<<25 | 1<<24 )
 #define RASR_SIZE ( 0b111110 )
+#define RASR_SRD_SHIFT 8
 #define RASR_ENABLE ( 1<<0 )
 //@}
 
@@ -112,6 +114,18 @@ typedef struct {
 /**@brief Memory region attribute is executable by user */
 #define EXECUTABLE 1
 
+/**@brief Subregions of the 8K heap region covering the main stack, the last two 1K eighths */
+#define HEAP_REGION_MSP_SUBREGIONS ( 0b11000000 )
+
+/**@brief Regions shared by every thread, 0 to 5. The stack regions 6 and 7 follow them */
+#define USER_REGIONS 6
+
+/**@brief Smallest region size log2 that has subregions */
+#define SRD_MIN_SIZE_LOG2 8
+
+/**@brief Copy of the shared user regions, so user memory can be checked without touching the MPU from an interrupt */
+static mpu_region_t user_regions[USER_REGIONS];
+
 /**@brief Stacking error.*/
 #define MSTKERR 0x1 << 4
 /**@brief Unstacking error.*/
@@ -134,8 +148,7 @@ extern char
   _u_rodata,
   _u_data,
   _u_bss,
-  __heap_low,
-  __psp_stack_bottom;
+  __heap_low;
 //@}
 
 /**
@@ -216,7 +229,7 @@ int mm_enable_user_access() {
   void *user_data = (void *)&_u_data;
   void *user_bss = (void *)&_u_bss;
   void *heap_low = (void *)&__heap_low;
-  void *user_stack = (void *)&__psp_stack_bottom;
+  void *shared_page = (void *)&__k_shared_low;
   int err = 0;
 
   //User code
@@ -231,49 +244,151 @@ int mm_enable_user_access() {
   //User bss
   err |= mm_region_enable(3, user_bss, mm_log2ceil_size(1000), !EXECUTABLE, !READ_ONLY);
 
-  //User heap
-  err |= mm_region_enable(4, heap_low, mm_log2ceil_size(4000), !EXECUTABLE, !READ_ONLY);
+  //User heap and default user stack, the first 6K of an 8K block. The main stack fills the last 2K and stays privileged
+  err |= mm_region_enable(4, heap_low, mm_log2ceil_size(8*1024), !EXECUTABLE, !READ_ONLY);
+  mm_region_disable_subregions(4, HEAP_REGION_MSP_SUBREGIONS);
+
+  //Kernel shared page
+  err |= mm_region_enable(5, shared_page, mm_log2ceil_size(KERNEL_SHARED_SIZE), !EXECUTABLE, READ_ONLY);
 
-  //Default user stack
-  err |= mm_region_enable(5, user_stack, mm_log2ceil_size(2000), !EXECUTABLE, !READ_ONLY);
+  //Keep what was loaded, subregions included
+  mpu_t *mpu = MPU_BASE;
+  for(int i = 0; i < USER_REGIONS; i++) {
+    mpu->RNR = i;
+    user_regions[i].rbar = mpu->RBAR;
+    user_regions[i].rasr = mpu->RASR;
+  }
 
   return err; 
 }
 
+/**
+ * @brief	Finds how a region treats an unprivileged access to an address. 
+
+ * @param[in]	region	The region. 
+ * @param[in]	addr	The address. 
+ * @param[in]	write	Non-zero for a write access. 
+ * @param[out]	end	Set to the end of the region, or of its subregion, holding addr. 
+
+ * @return	-1 if the region does not hold addr, 0 if it denies the access, 1 if it allows it. 
+ */
+static int mm_region_access(const volatile mpu_region_t *region, uint32_t addr, int write, uint32_t *end) {
+  uint32_t rasr = region->rasr;
+  if(!(rasr & RASR_ENABLE)) return -1;
+
+  uint32_t size_log2 = ((rasr & RASR_SIZE) >> 1) + 1;
+  uint32_t base = region->rbar & ~((1U << size_log2) - 1);
+  if(addr < base || addr - base >= (1U << size_log2)) return -1;
+
+  //A disabled subregion passes the access on to lower numbered regions
+  if(size_log2 >= SRD_MIN_SIZE_LOG2) {
+    uint32_t sub = (addr - base) >> (size_log2 - 3);
+    if(rasr & (1U << (RASR_SRD_SHIFT + sub))) return -1;
+    *end = base + ((sub + 1) << (size_log2 - 3));
+  } else {
+    *end = base + (1U << size_log2);
+  }
+
+  uint32_t ap = rasr & RASR_AP_USER;
+  return ap == RASR_AP_USER_READ_WRITE || (ap == RASR_AP_USER_READ_ONLY && !write);
+}
+
+/**
+ * @brief	Checks that a thread could access a range of memory itself, so the kernel may touch it on the thread's behalf. Uses the shared user regions and the given stack regions, never the MPU, so it is safe from interrupts. 
+
+ * @param[in]	stacks	Stack regions 6 and 7 of the thread, as built by mm_build_user_stacks. 
+ * @param[in]	ptr	Start of the range. 
+ * @param[in]	len	Bytes in the range. 
+ * @param[in]	write	Non-zero if the range is written. 
+
+ * @return	1 if every byte is accessible, 0 otherwise. 
+ */
+int mm_user_can_access(const volatile mpu_region_t *stacks, const void *ptr, uint32_t len, int write) {
+  uint32_t addr = (uint32_t)ptr;
+  uint32_t last = addr + len - 1;
+
+  if(len == 0) return 1;
+  if(last < addr) return 0; //Wraps the address space
+
+  while(1) {
+    //Higher numbered regions take priority, the background region is privileged only
+    int access = -1;
+    uint32_t end = 0;
+    for(int i = REGION_NUMBER_MAX; i >= 0 && access < 0; i--) {
+      const volatile mpu_region_t *region = (i < USER_REGIONS) ? &user_regions[i] : &stacks[i - USER_REGIONS];
+      access = mm_region_access(region, addr, write, &end);
+    }
+
+    if(access <= 0) return 0;
+    if(end == 0 || end - 1 >= last) return 1;
+    addr = end;
+  }
+}
+
 /** 
- * @brief	Enable user thread stack access based on memory access mode. 
+ * @brief	Builds the stack regions 6 and 7 of a thread so they can be loaded on every switch without recomputing them. 
+
+ * @param[out]	regions	The two regions, user stack then kernel stack.
+ * @param[in]	thread_num	Tcb_buffer idx of the thread, each thread's regions cover its own stack slot. If negative, the regions cover every thread's stacks for kernel only protection. Past the idle thread (the default thread, which has no slot) both regions are left disabled.
+
+ * @return	0 on success, -1 on failure.
  */
-int mm_enable_user_stacks(void *process_stack, void *kernel_stack, int thread_num) {
+int mm_build_user_stacks(volatile mpu_region_t *regions, int thread_num) {
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
 
-  uint32_t stack_size = ksb->stack_size;
-  uint32_t stack_size_bytes = (1<<(mm_log2ceil_size(stack_size*WORD_SIZE)));
-
+  uint32_t stack_size_bytes = ksb->stack_size;
   uint32_t log2_stack_size = mm_log2ceil_size(stack_size_bytes);
-  UNUSED uint32_t log2_all_stacks_size = mm_log2ceil_size(stack_size_bytes*(ksb->u_thread_ct+2));
 
   uint32_t user_stack_top = (uint32_t)&__thread_u_stacks_top;
   uint32_t kernel_stack_top = (uint32_t)&__thread_k_stacks_top;
 
-  if(thread_num < 0) { //Kernel only
+  mpu_region_t built[2];
+
+  if(thread_num < 0) { //Kernel only, one region covers every thread's stack
+    uint32_t log2_u_stacks = mm_log2ceil_size(user_stack_top - (uint32_t)&__thread_u_stacks_low);
+    uint32_t log2_k_stacks = mm_log2ceil_size(kernel_stack_top - (uint32_t)&__thread_k_stacks_low);
 
-    if(mm_region_enable(6, (void *)&__thread_u_stacks_low, 15, !EXECUTABLE, !READ_ONLY) < 0) return -1;
+    if(mm_region_build(&built[0], 6, (void *)&__thread_u_stacks_low, log2_u_stacks, !EXECUTABLE, !READ_ONLY) < 0) return -1;
 
-    if(mm_region_enable(7, (void *)&__thread_k_stacks_low, 
-15, !EXECUTABLE, !READ_ONLY) < 0) return -1;
+    if(mm_region_build(&built[1], 7, (void *)&__thread_k_stacks_low, log2_k_stacks, !EXECUTABLE, !READ_ONLY) < 0) return -1;
+
+  } else if((uint32_t)thread_num > ksb->max_threads) { //Default thread
+    built[0].rbar = RBAR_VALID | 6;
+    built[0].rasr = 0;
+    built[1].rbar = RBAR_VALID | 7;
+    built[1].rasr = 0;
 
   } else { //Per thread
    
-    uint32_t process_bottom = user_stack_top - ((user_stack_top - (uint32_t)process_stack)/stack_size_bytes + 1)*stack_size_bytes;
-    uint32_t kernel_bottom = kernel_stack_top - ((kernel_stack_top - (uint32_t)kernel_stack)/stack_size_bytes + 1)*stack_size_bytes;
+    uint32_t process_bottom = user_stack_top - (thread_num + 1)*stack_size_bytes;
+    uint32_t kernel_bottom = kernel_stack_top - (thread_num + 1)*stack_size_bytes;
+
+    if(mm_region_build(&built[0], 6, (void *)process_bottom, log2_stack_size, !EXECUTABLE, !READ_ONLY) < 0) return -1;
 
-    if(mm_region_enable(6, (void *)process_bottom, log2_stack_size, !EXECUTABLE, !READ_ONLY) < 0) return -1;
+    if(mm_region_build(&built[1], 7, (void *)kernel_bottom, log2_stack_size, !EXECUTABLE, !READ_ONLY) < 0) return -1;
+  }
 
-    if(mm_region_enable(7, (void *)kernel_bottom, log2_stack_size, !EXECUTABLE, !READ_ONLY) < 0) return -1;
+  for(int i = 0; i < 2; i++) {
+    regions[i].rbar = built[i].rbar;
+    regions[i].rasr = built[i].rasr;
   }
   return 0;
 }
 
+/** 
+ * @brief	Loads stack regions 6 and 7 built by mm_build_user_stacks. The region number is carried in each RBAR value, so both regions go out as one burst through RBAR/RASR and the first alias pair. 
+
+ * @param[in]	regions	The two regions, user stack then kernel stack.
+ */
+void mm_load_user_stacks(const volatile mpu_region_t *regions) {
+  mpu_t *mpu = MPU_BASE;
+
+  mpu->RBAR = regions[0].rbar;
+  mpu->RASR = regions[0].rasr;
+  mpu->RBAR_A1 = regions[1].rbar;
+  mpu->RASR_A1 = regions[1].rasr;
+}
+
 /**
  * @brief	Disable current user thread stack regions. Always 6 and 7. 
  */
@@ -310,6 +425,44 @@ int mm_region_enable(
   uint8_t size_log2,
   int execute,
   int user_write_access
+){
+  mpu_region_t region;
+
+  if (mm_region_build(&region, region_number, base_address, size_log2, execute, user_write_access) < 0)
+    return -1;
+
+  mpu_t *mpu = MPU_BASE;
+
+  mpu->RBAR = region.rbar;
+  mpu->RASR = region.rasr;
+
+  return 0;
+}
+
+/**
+ * @brief  Computes the register values of a memory protection region without
+ *         touching the MPU. Regions must be aligned!
+ *
+ * @param  region             Filled with the RBAR and RASR values. RBAR has
+ *                            the valid bit and region number set, so writing
+ *                            it also selects the region.
+ * @param  region_number      The region number.
+ * @param  base_address       The region's base (starting) address.
+ * @param  size_log2          log[2] of the region size.
+ * @param  execute            1 if the region should be executable by the user.
+ *                            0 otherwise.
+ * @param  user_write_access  1 if the user should have write access, 0 if
+ *                            read-only
+ *
+ * @return 0 on success, -1 on failure
+ */
+int mm_region_build(
+  mpu_region_t *region,
+  uint32_t region_number,
+  void *base_address,
+  uint8_t size_log2,
+  int execute,
+  int user_write_access
 ){
   if (region_number > REGION_NUMBER_MAX) {
     printk("Invalid region number\n");
@@ -326,16 +479,13 @@ int mm_region_enable(
     return -1;
   }
 
-  mpu_t *mpu = MPU_BASE;
-
-  mpu->RNR = region_number & RNR_REGION;
-  mpu->RBAR = (uint32_t)base_address;
+  region->rbar = (uint32_t)base_address | RBAR_VALID | (region_number & RBAR_REGION);
 
   uint32_t size = ((size_log2 - 1) << 1) & RASR_SIZE;
   uint32_t ap = user_write_access ? RASR_AP_USER_READ_WRITE : RASR_AP_USER_READ_ONLY;
   uint32_t xn = execute ? 0 : RASR_XN;
 
-  mpu->RASR = size | ap | xn | RASR_ENABLE;
+  region->rasr = size | ap | xn | RASR_ENABLE;
 
   return 0;
 }
@@ -351,6 +501,20 @@ void mm_region_disable( uint32_t region_number ){
   mpu->RASR &= ~RASR_ENABLE;
 }
 
+/**
+ * @brief  Disables subregions of an enabled memory protection region. Each
+ *         subregion is an eighth of the region. Accesses to a disabled one
+ *         fall through to lower numbered regions or the background region.
+ *
+ * @param  region_number      The region number.
+ * @param  subregions         Bit i set disables the i-th eighth.
+ */
+void mm_region_disable_subregions( uint32_t region_number, uint8_t subregions ){
+  mpu_t *mpu = MPU_BASE;
+  mpu->RNR = region_number & RNR_REGION;
+  mpu->RASR |= (uint32_t)subregions << RASR_SRD_SHIFT;
+}
+
 /**
  * @brief  Returns ceiling (log_2 n).
  */
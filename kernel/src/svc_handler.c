@@ -16,9 +16,18 @@
 #include <syscall.h>
 #include <syscall_thread.h>
 #include <syscall_mutex.h>
+#include <syscall_sem.h>
+#include <syscall_event.h>
+#include <syscall_queue.h>
 #include <svc_num.h>
+#include <svc_batch.h>
 #include <arm.h>
 
+/**
+* Bounds of the v2 abi svc stubs, set by the linker script. 
+*/
+extern char _svc_v2_stub_start, _svc_v2_stub_end;
+
 /**
 * Struct representing auto-saved stack frame. Includes r0-r3, r12, lr, pc, PSR. 
 */
@@ -39,106 +48,331 @@ typedef struct {
   uint32_t pc;
   /**program status register*/
   uint32_t xPSR;
-  /**5th stack-saved argument*/
+  /**5th stack-saved argument, only here if the frame has no fpu state*/
   uint32_t arg5; 
 } stack_frame_t;
 
+/** Words in an exception frame extended with s0-s15, fpscr and a reserved word. The 5th argument follows it. */
+#define FP_FRAME_WORDS 26
+
+#define UNUSED __attribute__((unused))
+
+/** Signature shared by all entries of the syscall table. The return value is written back to r0. */
+typedef int (*svc_fn_t)(stack_frame_t *s, uint32_t exc_return);
+
 /**
-* @brief	C handler of svc calls. Will map an svc asm call to the correct c sys call. 
+* @brief	Fetches the 5th argument of a syscall, which the caller pushed just above the exception frame.
 
-* @param	psp	The psp of the svc call. Will be used to access the svc instruction itself from the pc. As well as accessing for accessing arguments
+* @param	s	Exception frame of the svc call.
+* @param	exc_return	EXC_RETURN value of the svc exception. Tells whether the frame was extended with fpu state.
+
+* @return	The 5th argument.
 */
-void svc_c_handler(void *psp) {
-  stack_frame_t *s = (stack_frame_t *)psp;
-  uint32_t *pc = (uint32_t *)(s -> pc -2);
-  uint8_t svc_number = *(pc) & 0xFF;
+static uint32_t svc_arg5(stack_frame_t *s, uint32_t exc_return) {
+  return (exc_return & EXC_RETURN_STD_FRAME) ? s->arg5 : ((uint32_t *)s)[FP_FRAME_WORDS];
+}
+
+static int svc_sbrk(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return (unsigned int)sys_sbrk(s->r0);
+}
+
+static int svc_write(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_write(s->r0, (void *)(s->r1), s->r2);
+}
+
+static int svc_unsupported(UNUSED stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return -1;
+}
+
+static int svc_read(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_read(s->r0, (void *)(s->r1), s->r2);
+}
+
+static int svc_read_mode(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_read_mode(s->r0);
+}
+
+static int svc_exit(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  sys_exit(s->r0);
+  return 0;
+}
+
+static int svc_thr_init(stack_frame_t *s, uint32_t exc_return) {
+  return sys_thread_init(s->r0, s->r1, (void *)s->r2, (protection_mode)s->r3, svc_arg5(s, exc_return));
+}
+
+static int svc_thr_create(stack_frame_t *s, uint32_t exc_return) {
+  return sys_thread_create((void *)s->r0, s->r1, s->r2, s->r3, (void *)svc_arg5(s, exc_return));
+}
+
+static int svc_thr_kill(UNUSED stack_frame_t *s, UNUSED uint32_t exc_return) {
+  sys_thread_kill();
+  return 0;
+}
+
+static int svc_schd_start(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_scheduler_start(s->r0);
+}
+
+static int svc_mut_init(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return (int)sys_mutex_init((uint32_t)s->r0, NULL, NULL);
+}
+
+static int svc_mut_init_fast(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return (int)sys_mutex_init((uint32_t)s->r0, (volatile uint32_t *)s->r1, (mutex_fast_t *)s->r2);
+}
+
+static int svc_mut_lock(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  sys_mutex_lock((kmutex_t *)s->r0);
+  return 0;
+}
+
+static int svc_mut_unlock(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  sys_mutex_unlock((kmutex_t *)s->r0);
+  return 0;
+}
+
+static int svc_sem_init(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return (int)sys_sem_init((uint32_t)s->r0);
+}
+
+static int svc_sem_take(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_sem_take((ksem_t *)s->r0);
+}
+
+static int svc_sem_give(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  sys_sem_give((ksem_t *)s->r0);
+  return 0;
+}
+
+static int svc_evt_init(UNUSED stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return (int)sys_event_init();
+}
+
+static int svc_evt_set(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_event_set((kevent_t *)s->r0, s->r1);
+}
+
+static int svc_evt_clear(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_event_clear((kevent_t *)s->r0, s->r1);
+}
 
-  int out = 0;
+static int svc_evt_wait(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_event_wait((kevent_t *)s->r0, s->r1, s->r2);
+}
 
-  switch (svc_number) {
-    case SVC_SBRK:
-      out = (unsigned int)sys_sbrk(s -> r0);
-      break;
+static int svc_q_init(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return (int)sys_queue_init((void *)s->r0, s->r1, s->r2);
+}
 
-    case SVC_WRITE:
-      out = sys_write(s->r0, (void *)(s->r1), s->r2);
-      break;
+static int svc_q_send(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_queue_send((kqueue_t *)s->r0, (const void *)s->r1);
+}
 
-    case SVC_ISATTY:
-      out = -1;
-      break;
+static int svc_q_recv(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_queue_recv((kqueue_t *)s->r0, (void *)s->r1);
+}
 
-    case SVC_FSTAT:
-      out = -1;
-      break;
+static int svc_q_alloc(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return (int)sys_queue_alloc((kqueue_t *)s->r0);
+}
 
-    case SVC_LSEEK:
-      out = -1;
-      break;
+static int svc_q_send_slot(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_queue_send_slot((kqueue_t *)s->r0, (void *)s->r1);
+}
 
-    case SVC_READ:
-      out = sys_read(s->r0, (void *)(s->r1), s->r2);
-      break;
+static int svc_q_recv_slot(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return (int)sys_queue_recv_slot((kqueue_t *)s->r0);
+}
 
-    case SVC_EXIT:
-      sys_exit(s->r0);
-      break;
+static int svc_q_release(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_queue_release((kqueue_t *)s->r0, (void *)s->r1);
+}
 
-    case SVC_THR_INIT:
-      out = sys_thread_init(s->r0, s->r1, (void *)s->r2, (protection_mode)s->r3, s -> arg5);
-      break;
+static int svc_rw_init(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return (int)sys_rwlock_init((uint32_t)s->r0, (uint32_t)s->r1);
+}
 
-    case SVC_THR_CREATE:
-      out = sys_thread_create((void *)s->r0, s->r1, s->r2, s->r3, (void *)s->arg5);
-      break;
+static int svc_rw_rdlock(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  sys_rwlock_read_lock((kmutex_t *)s->r0);
+  return 0;
+}
 
-    case SVC_THR_KILL:
-      sys_thread_kill();
-      break;
+static int svc_wait(UNUSED stack_frame_t *s, UNUSED uint32_t exc_return) {
+  sys_wait_until_next_period();
+  return 0;
+}
 
-    case SVC_SCHD_START:
-      out = sys_scheduler_start(s->r0);
-      break;
+static int svc_time(UNUSED stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_get_time();
+}
 
-    case SVC_MUT_INIT:
-      out = (int)sys_mutex_init((uint32_t)s->r0);
-      break;
+static int svc_priority(UNUSED stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_get_priority();
+}
+
+static int svc_thr_time(UNUSED stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_thread_time();
+}
 
-    case SVC_MUT_LOK:
-      sys_mutex_lock((kmutex_t *)s->r0);
-      break;
+static int svc_io_init(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_io_ring_init((io_ring_t *)s->r0, s->r1);
+}
+
+static int svc_io_submit(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_io_ring_submit((io_ring_t *)s->r0);
+}
 
-    case SVC_MUT_ULK:
-      sys_mutex_unlock((kmutex_t *)s->r0);
-      break;
+/**
+* @brief	Reads the DWT cycle counter for user benchmarks, which cannot reach it unprivileged. It only counts in BENCH builds, 0 otherwise. 
+*/
+static int svc_bench_cycles(UNUSED stack_frame_t *s, UNUSED uint32_t exc_return) {
+#ifdef BENCH
+  return read_cycle_counter();
+#else
+  return 0;
+#endif
+}
 
-    case SVC_WAIT:
-      sys_wait_until_next_period();
-      break;
+static int svc_io_exit(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_io_ring_exit((io_ring_t *)s->r0);
+}
 
-    case SVC_TIME: 
-      out = sys_get_time();
-      break;
+static int svc_servo_enable(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_servo_enable((uint8_t)s->r1, (unsigned char)s->r2);
+}
 
-    case SVC_PRIORITY:
-      out = sys_get_priority();
-      break;
+static int svc_servo_set(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  return sys_servo_set((unsigned char)s->r1, (unsigned char)s->r2);
+}
 
-    case SVC_THR_TIME:
-      out = sys_thread_time();
-      break;
+static int svc_batch(stack_frame_t *s, uint32_t exc_return);
 
-    case SVC_SERVO_ENABLE:
-      out = sys_servo_enable((uint8_t)s->r1, (unsigned char)s->r2);
-      break;
+/** Syscall implementations indexed by svc number. Unused numbers are NULL. Lives in flash. */
+static const svc_fn_t svc_table[] = {
+  [SVC_SBRK]         = svc_sbrk,
+  [SVC_WRITE]        = svc_write,
+  [SVC_FSTAT]        = svc_unsupported,
+  [SVC_ISATTY]       = svc_unsupported,
+  [SVC_LSEEK]        = svc_unsupported,
+  [SVC_READ]         = svc_read,
+  [SVC_EXIT]         = svc_exit,
+  [SVC_THR_INIT]     = svc_thr_init,
+  [SVC_THR_CREATE]   = svc_thr_create,
+  [SVC_THR_KILL]     = svc_thr_kill,
+  [SVC_SCHD_START]   = svc_schd_start,
+  [SVC_MUT_INIT]     = svc_mut_init,
+  [SVC_MUT_LOK]      = svc_mut_lock,
+  [SVC_MUT_ULK]      = svc_mut_unlock,
+  [SVC_WAIT]         = svc_wait,
+  [SVC_TIME]         = svc_time,
+  [SVC_PRIORITY]     = svc_priority,
+  [SVC_THR_TIME]     = svc_thr_time,
+  [SVC_SERVO_ENABLE] = svc_servo_enable,
+  [SVC_SERVO_SET]    = svc_servo_set,
+  [SVC_SEM_INIT]     = svc_sem_init,
+  [SVC_SEM_TAKE]     = svc_sem_take,
+  [SVC_SEM_GIVE]     = svc_sem_give,
+  [SVC_EVT_INIT]     = svc_evt_init,
+  [SVC_EVT_SET]      = svc_evt_set,
+  [SVC_EVT_CLEAR]    = svc_evt_clear,
+  [SVC_EVT_WAIT]     = svc_evt_wait,
+  [SVC_Q_INIT]       = svc_q_init,
+  [SVC_Q_SEND]       = svc_q_send,
+  [SVC_Q_RECV]       = svc_q_recv,
+  [SVC_Q_ALLOC]      = svc_q_alloc,
+  [SVC_Q_SEND_SLOT]  = svc_q_send_slot,
+  [SVC_Q_RECV_SLOT]  = svc_q_recv_slot,
+  [SVC_Q_RELEASE]    = svc_q_release,
+  [SVC_RW_INIT]      = svc_rw_init,
+  [SVC_RW_RDLOCK]    = svc_rw_rdlock,
+  [SVC_RW_WRLOCK]    = svc_mut_lock,
+  [SVC_RW_UNLOCK]    = svc_mut_unlock,
+  [SVC_BATCH]        = svc_batch,
+  [SVC_IO_INIT]      = svc_io_init,
+  [SVC_IO_SUBMIT]    = svc_io_submit,
+  [SVC_READ_MODE]    = svc_read_mode,
+  [SVC_IO_EXIT]      = svc_io_exit,
+  [SVC_MUT_INIT_FAST] = svc_mut_init_fast,
+  [SVC_BENCH_CYCLES] = svc_bench_cycles,
+};
 
-    case SVC_SERVO_SET:
-      out = sys_servo_set((unsigned char)s->r1, (unsigned char)s->r2);
-      break; 
+/** Number of entries in the syscall table */
+#define SVC_TABLE_SIZE (sizeof(svc_table) / sizeof(svc_table[0]))
 
-    default:
-      DEBUG_PRINT( "Not implemented, svc num %d\n", svc_number );
-      ASSERT( 0 );
+/**
+* @brief	Runs a batch of syscalls in one kernel entry, each dispatched through the syscall table as if it had been called on its own. Stops after an operation that made the thread wait or block, as the rest were issued for the cpu time it had before. Batches do not nest.
+
+* @param	s	Exception frame of the svc call. r0 holds the svc_op_t array, r1 its length.
+* @param	exc_return	Unused, operations always take their arguments from their descriptor.
+
+* @return	Number of operations completed, each with its result written. An invalid operation ends the batch uncompleted. -1 if the array is empty, too long or not memory the caller can write.
+*/
+static int svc_batch(stack_frame_t *s, UNUSED uint32_t exc_return) {
+  svc_op_t *ops = (svc_op_t *)s->r0;
+  uint32_t n = s->r1;
+
+  if(n == 0 || n > UINT32_MAX / sizeof(svc_op_t)) return -1;
+  if(!thread_can_access(get_running_thread(), ops, n * sizeof(svc_op_t), 1)) {
+    DEBUG_PRINT( "Invalid batch array\n" );
+    return -1;
+  }
+
+  for(uint32_t i = 0; i < n; i++) {
+    uint32_t svc_number = ops[i].svc;
+
+    if(svc_number >= SVC_TABLE_SIZE || svc_table[svc_number] == NULL || svc_number == SVC_BATCH) {
+      DEBUG_PRINT( "Invalid batch operation, svc num %d\n", (int)svc_number );
+      return i;
+    }
+
+    stack_frame_t frame;
+    frame.r0 = ops[i].args[0];
+    frame.r1 = ops[i].args[1];
+    frame.r2 = ops[i].args[2];
+    frame.r3 = ops[i].args[3];
+    frame.arg5 = ops[i].args[4];
+
+    uint32_t block_ct = get_block_ct();
+    int result = svc_table[svc_number](&frame, EXC_RETURN_STD_FRAME);
+
+    //The thread's memory view may have changed while it was away, so the array is checked again before the result goes out
+    if(get_block_ct() != block_ct) {
+      if(!thread_can_access(get_running_thread(), &ops[i], sizeof(svc_op_t), 1)) return i;
+      ops[i].result = result;
+      return i + 1;
+    }
+    ops[i].result = result;
+  }
+
+  return n;
+}
+
+/**
+* @brief	C handler of svc calls. Will map an svc asm call to the correct c sys call through the syscall table. 
+*
+* Stubs using the v2 abi carry the svc number in r12, which is read from the stacked frame. They live in their own linker section, so a v2 call is told apart by its return address alone, without loading the svc instruction from flash. Anything else is an older binary. It is decoded from the svc immediate, and r12 is ignored because it is scratch for those callers. The immediate SVC_ABI2 is reserved for v2 stubs, so a copy linked outside the section still works.
+
+* @param	psp	The psp of the svc call. Will be used to access the svc instruction itself from the pc. As well as accessing for accessing arguments
+* @param	exc_return	EXC_RETURN value of the svc exception. Tells whether the frame was extended with fpu state. 
+*/
+void svc_c_handler(void *psp, uint32_t exc_return) {
+  stack_frame_t *s = (stack_frame_t *)psp;
+  uint32_t svc_number;
+
+  if(s->pc > (uint32_t)&_svc_v2_stub_start && s->pc <= (uint32_t)&_svc_v2_stub_end) {
+    svc_number = s->r12;
+  } else {
+    svc_number = *(uint16_t *)(s->pc - 2) & 0xFF;
+    if(svc_number == SVC_ABI2) svc_number = s->r12;
   }
-  s -> r0 = out;
+
+  if(svc_number >= SVC_TABLE_SIZE || svc_table[svc_number] == NULL) {
+    DEBUG_PRINT( "Not implemented, svc num %d\n", (int)svc_number );
+    ASSERT( 0 );
+    s -> r0 = 0;
+    return;
+  }
+
+  s -> r0 = svc_table[svc_number](s, exc_return);
 }
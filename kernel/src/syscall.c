@@ -17,6 +17,8 @@
 #include <kmalloc.h>
 #include <arm.h>
 #include <debug.h>
+#include <io_ring.h>
+#include <syscall_thread.h>
 
 /** Bottom of user heap */
 extern char __heap_low[];
@@ -27,6 +29,45 @@ extern char __heap_top[];
 /** Current heap brk */
 static char *heap_brk = 0;
 
+/** Bytes copied into the transmit buffer per critical section, bounding how long writes keep interrupts off */
+#define WRITE_CHUNK 16
+
+/** Free transmit buffer bytes at which blocked writers are woken. Waking them for less would have them block again after a few bytes */
+#define TX_WAKE_SPACE 256
+
+/** Threads blocked in sys_write on a full transmit buffer */
+static kwait_t tx_waiters;
+
+/** Bytes copied out of the receive buffer per critical section */
+#define READ_CHUNK 16
+
+/** Threads blocked in sys_read until input is ready */
+static kwait_t rx_waiters;
+
+/** Bytes each reader asked for, by tcb_buffer idx. What raw mode input must reach for it to go ahead */
+static volatile int rx_want[MAX_U_THREADS + 2];
+
+#ifdef BENCH
+/** Longest time sys_write kept interrupts off, in cycles */
+static uint32_t write_irq_off_max = 0;
+#endif
+
+/** Maximum number of registered io rings */
+#define MAX_IO_RINGS 4
+
+/**
+* Kernel side of a registered io ring. 
+*/
+typedef struct {
+  io_ring_t *ring; /**< The shared rings in user memory, NULL while the slot is free */
+  int file; /**< 1 if the ring writes to stdout, 0 if it reads from stdin */
+  uint32_t owner; /**< Tcb_buffer idx of the registering thread, requests move its memory only */
+  uint32_t done; /**< Bytes of the request at sq_head moved so far */
+} kio_ring_t;
+
+/** Registered io rings */
+static kio_ring_t io_rings[MAX_IO_RINGS];
+
 /**
 * @brief	sbrk system call implementation. Attempts to increase available heap size by an increment. 
 
@@ -49,6 +90,15 @@ void *sys_sbrk(int incr){
   return (void *)tmp; 
 }
 
+/**
+* @brief	Wait queue condition of sys_write. 
+
+* @return	Nonzero if the transmit buffer has room. 
+*/
+static int tx_has_space(){
+  return uart_tx_space() > 0;
+}
+
 /**
 * @brief	Implementation of sys call write. Maps to user calls of write. 
 
@@ -57,20 +107,87 @@ void *sys_sbrk(int incr){
 * @param	len	Number of bytes which should be written. 
 
 * @return	-1 on failure, otherwise the number of byte sucessfully written to stdout. 
+*
+* Bytes are copied in chunks of WRITE_CHUNK, each with interrupts off only for its copy. A user thread that finds the transmit buffer full blocks until the uart irq has drained it. 
 */
 int sys_write(int file, char *ptr, int len){
-  if(file == 1) {
- 
+  if(file != 1) return -1; //Invalid file descriptor
+
+  int written = 0;
+  while(written < len) {
+    int chunk_end = (len - written > WRITE_CHUNK) ? written + WRITE_CHUNK : len;
+
+    int state = save_interrupt_state_and_disable();
+#ifdef BENCH
+    uint32_t start = read_cycle_counter();
+#endif
+    written += uart_put_bytes(ptr + written, chunk_end - written);
+#ifdef BENCH
+    uint32_t cycles = read_cycle_counter() - start;
+    if(cycles > write_irq_off_max) write_irq_off_max = cycles;
+#endif
+    restore_interrupt_state(state);
+
+    //Transmit buffer full, wait for the uart irq to drain it
+    if(written < chunk_end && wait_queue_block(&tx_waiters, tx_has_space) < 0) {
+      while(!uart_tx_space()); //Idle and default threads cannot block, the irq drains with interrupts on
+    }
+  }
+  return len;
+}
+
+/**
+* @brief	Wakes threads blocked in sys_write once the transmit buffer has drained far enough. Called by the uart irq. 
+*/
+void write_tx_wake(){
+  if(uart_tx_space() >= TX_WAKE_SPACE) wait_queue_wake(&tx_waiters);
+}
+
+/**
+* @brief	Wait queue condition of sys_read. 
+
+* @return	Nonzero if the input the running reader waits for is ready. 
+*/
+static int rx_ready(){
+  return uart_rx_ready(rx_want[get_running_thread()]);
+}
+
+/**
+* @brief	Copies input that sys_read found ready out of the receive buffer, in chunks of READ_CHUNK. 
+
+* @param	ptr	Pointer to buffer where bytes will be read to. 
+* @param	len	Number of bytes to read into ptr buffer. 
+* @param[out]	line_end	Set once a canonical read took its newline or EOT. 
+
+* @return	Number of bytes read into the buffer, 0 if another reader took the input first. 
+*/
+static int read_ready(char *ptr, int len, int *line_end){
+  char c;
+  int count = 0;
+  int raw = uart_get_raw();
+  while(count < len && !*line_end) {
+    int chunk_end = (len - count > READ_CHUNK) ? count + READ_CHUNK : len;
+    int empty = 0;
+
     int state = save_interrupt_state_and_disable();
-    for(int i = 0; i < len; i++) {
-       while(uart_put_byte(ptr[i]));
+    if(raw) {
+      int taken = uart_get_bytes(ptr + count, chunk_end - count);
+      empty = (count + taken < chunk_end);
+      count += taken;
+    }
+    while(!raw && count < chunk_end && !*line_end) {
+      if(uart_get_byte(&c)) {
+        empty = 1;
+        break;
+      }
+      *line_end = (c == '\n' || c == EOT);
+      if(c != EOT) ptr[count++] = c;
     }
     restore_interrupt_state(state);
-    return len;
-  }else{
-    //Invalid file descriptor
-    return -1;
+
+    if(empty) break;
   }
+  return count;
 }
 
 /**
@@ -81,33 +198,48 @@ int sys_write(int file, char *ptr, int len){
 * @param	len	Number of bytes to read into ptr buffer. 
 
 * @return	-1 on failure, otherwise the number of bytes read into the buffer from stdin. This may be <= len. 
+*
+* Echo and line editing happen in the uart irq. A user thread sleeps until a line is complete, or in raw mode until len bytes arrived, then copies them out in chunks of READ_CHUNK. A canonical read ends after a newline, or at EOT, which is not copied. Every reader is woken by new input, so one that finds its input taken by another reader or an io ring goes back to sleep. 
 */
 int sys_read(int file, char *ptr, int len){
   if(file != 0) return -1;
-  char c;
+  if(len <= 0) return 0;
+
   int count = 0;
-  while(count < len) {
-     if(!uart_get_byte(&c)) {
-        if(c == '\n' || c == '\r') {
-           uart_put_byte('\n');
-           ptr[count] = '\n';
-           count++;
-           return count;
-        }else if(c == '\b'){
-           if(count > 0) count--;
-           uart_put_byte('\b');
-           uart_put_byte(' ');
-        }else if(c == EOT) {
-           return count;
-        }
-        uart_put_byte(c);
-        *(ptr+count) = c;
-        count++;
-     }
+  int line_end = 0;
+
+  rx_want[get_running_thread()] = len;
+  while(count == 0 && !line_end) {
+    while(!uart_rx_ready(len)) {
+      if(wait_queue_block(&rx_waiters, rx_ready) < 0) {
+        while(!uart_rx_ready(len)); //Idle and default threads cannot block, the irq receives with interrupts on
+      }
+    }
+    count = read_ready(ptr, len, &line_end);
   }
   return count;
 }
 
+/**
+* @brief	Implementation of system call read_mode. Switches stdin between canonical and raw input, discarding input not yet read. 
+
+* @param	raw	1 for raw mode, 0 for canonical mode.
+
+* @return	0 on success, -1 for an unknown mode.
+*/
+int sys_read_mode(int raw){
+  if(raw != 0 && raw != 1) return -1;
+  uart_set_raw(raw);
+  return 0;
+}
+
+/**
+* @brief	Wakes threads blocked in sys_read once new input is ready. Each checks its own wanted count and sleeps again if it is not met. Called by the uart irq. 
+*/
+void read_rx_wake(){
+  if(uart_rx_ready(1)) wait_queue_wake(&rx_waiters);
+}
+
 /**
 * @brief	Implementation of system exit. Will display exit status on the led display, write status to stdout, and flush the uart before sleeping indefinitely. 
 
@@ -115,8 +247,230 @@ int sys_read(int file, char *ptr, int len){
 */
 void sys_exit(int status){
   led_set_display(status);
+#ifdef BENCH
+  printk("write: %u cycles max with interrupts off\n", write_irq_off_max);
+#endif
   printk("%d\n", status);
   uart_flush();
   disable_interrupts();
   wait_for_interrupt();
 }
+
+/**
+* @brief	Returns the request at the head of a ring if it can progress, which needs room for its completion. 
+
+* @param	kio	The ring.
+
+* @return	The request, NULL if there is none or the completion ring is full.
+*/
+static io_sqe_t *io_ring_next(kio_ring_t *kio) {
+  io_ring_t *ring = kio->ring;
+
+  if(ring->sq_head == ring->sq_tail) return NULL;
+  if(ring->cq_tail - ring->cq_head >= IO_RING_ENTRIES) return NULL;
+  return &ring->sq[ring->sq_head & IO_RING_MASK];
+}
+
+/**
+* @brief	Checks the buffer of a request against the memory of the thread owning the ring. The thread may rewrite a request at any time, so it is checked every time it is picked up. 
+
+* @param	kio	The ring.
+* @param	buf	Buffer of the request.
+* @param	len	Bytes in the buffer.
+* @param	write	Non-zero if the kernel writes the buffer, for a read request.
+
+* @return	Nonzero if the owner could access the buffer itself.
+*/
+static int io_ring_buf_ok(kio_ring_t *kio, uint32_t buf, uint32_t len, int write) {
+  return thread_can_access(kio->owner, (const void *)buf, len, write);
+}
+
+/**
+* @brief	Posts the completion of the request at the head of a ring and moves on to the next. 
+
+* @param	kio	The ring.
+* @param	result	Bytes the request moved.
+*/
+static void io_ring_complete(kio_ring_t *kio, int32_t result) {
+  io_ring_t *ring = kio->ring;
+  io_cqe_t *cqe = &ring->cq[ring->cq_tail & IO_RING_MASK];
+
+  cqe->tag = ring->sq[ring->sq_head & IO_RING_MASK].tag;
+  cqe->result = result;
+  ring->cq_tail++;
+  ring->sq_head++;
+  kio->done = 0;
+}
+
+/**
+* @brief	Moves up to WRITE_CHUNK bytes of pending write requests of a ring into the transmit buffer. The uart irq continues as it sends them. 
+
+* @param	kio	The ring.
+*/
+static void io_ring_write(kio_ring_t *kio) {
+  io_sqe_t *sqe;
+  uint32_t budget = WRITE_CHUNK;
+
+  while((sqe = io_ring_next(kio)) != NULL) {
+    char *buf = (char *)sqe->buf;
+    uint32_t len = sqe->len;
+    if(!io_ring_buf_ok(kio, (uint32_t)buf, len, 0)) {
+      io_ring_complete(kio, -1);
+      continue;
+    }
+
+    while(kio->done < len) {
+      if(!budget-- || uart_put_byte(buf[kio->done])) return; //Continued by the uart irq once bytes go out
+      kio->done++;
+    }
+    io_ring_complete(kio, len);
+  }
+}
+
+/**
+* @brief	Moves received bytes into pending read requests of a ring until none are left. A request completes when full or, in canonical mode, at a newline or EOT, like read(). In canonical mode the uart irq has already echoed and edited the line, in raw mode bytes pass through unchanged. 
+
+* @param	kio	The ring.
+*/
+static void io_ring_read(kio_ring_t *kio) {
+  io_sqe_t *sqe;
+  char c;
+
+  while((sqe = io_ring_next(kio)) != NULL) {
+    char *buf = (char *)sqe->buf;
+    uint32_t len = sqe->len;
+    if(!io_ring_buf_ok(kio, (uint32_t)buf, len, 1)) {
+      io_ring_complete(kio, -1);
+      continue;
+    }
+
+    if(uart_get_raw()) {
+      if(kio->done < len) kio->done += uart_get_bytes(buf + kio->done, len - kio->done);
+      if(kio->done < len) return; //Continued by the uart irq once more bytes arrive
+      io_ring_complete(kio, len);
+      continue;
+    }
+
+    int line_end = 0;
+    while(kio->done < len && !line_end) {
+      if(uart_get_byte(&c)) return; //Continued by the uart irq once a byte arrives
+      if(c == EOT) break;
+      line_end = (c == '\n');
+      buf[kio->done++] = c;
+    }
+    io_ring_complete(kio, kio->done);
+  }
+}
+
+/**
+* @brief	Implementation of system call io_ring_init. Registers rings a thread posts stdout writes or stdin reads on. They stay tied to the thread until it unregisters them or is killed. 
+
+* @param	ring	The rings, in memory the thread can write. Must be empty.
+* @param	file	1 for a ring of writes to stdout, 0 for reads from stdin.
+
+* @return	0 on success, -1 if the file is not supported, the ring is not the caller's or already registered, or max_io_rings would be exceeded.
+*/
+int sys_io_ring_init(io_ring_t *ring, int file) {
+  uint32_t owner = get_running_thread();
+
+  if(file != 0 && file != 1) return -1;
+  if(!thread_can_access(owner, ring, sizeof(io_ring_t), 1)) return -1;
+
+  int state = save_interrupt_state_and_disable();
+  int free_slot = -1;
+  for(int i = 0; i < MAX_IO_RINGS; i++) {
+    if(io_rings[i].ring == ring) {
+      free_slot = -1;
+      break;
+    }
+    if(io_rings[i].ring == NULL && free_slot < 0) free_slot = i;
+  }
+
+  if(free_slot < 0) {
+    restore_interrupt_state(state);
+    return -1;
+  }
+
+  io_rings[free_slot].file = file;
+  io_rings[free_slot].owner = owner;
+  io_rings[free_slot].done = 0;
+  io_rings[free_slot].ring = ring;
+  restore_interrupt_state(state);
+  return 0;
+}
+
+/**
+* @brief	Implementation of system call io_ring_exit. Unregisters rings, abandoning requests still in progress. The thread may reuse their memory afterwards. 
+
+* @param	ring	The rings.
+
+* @return	0 on success, -1 if the caller never registered the ring.
+*/
+int sys_io_ring_exit(io_ring_t *ring) {
+  uint32_t owner = get_running_thread();
+
+  int state = save_interrupt_state_and_disable();
+  for(int i = 0; i < MAX_IO_RINGS; i++) {
+    if(io_rings[i].ring == ring && io_rings[i].owner == owner) {
+      io_rings[i].ring = NULL;
+      restore_interrupt_state(state);
+      return 0;
+    }
+  }
+  restore_interrupt_state(state);
+  return -1;
+}
+
+/**
+* @brief	Unregisters every io ring of a thread, so the uart irq no longer touches its memory. 
+
+* @param	buf_idx	Tcb_buffer idx of the thread.
+*/
+void io_ring_drop(uint32_t buf_idx) {
+  int state = save_interrupt_state_and_disable();
+  for(int i = 0; i < MAX_IO_RINGS; i++) {
+    if(io_rings[i].ring != NULL && io_rings[i].owner == buf_idx) io_rings[i].ring = NULL;
+  }
+  restore_interrupt_state(state);
+}
+
+/**
+* @brief	Implementation of system call io_ring_submit. Starts on requests posted to a ring without waiting for them. The uart irq carries them on. 
+
+* @param	ring	The rings.
+
+* @return	Number of requests still in progress, -1 if the caller never registered the ring.
+*/
+int sys_io_ring_submit(io_ring_t *ring) {
+  uint32_t owner = get_running_thread();
+
+  for(uint32_t i = 0; i < MAX_IO_RINGS; i++) {
+    if(ring == NULL || io_rings[i].ring != ring || io_rings[i].owner != owner) continue;
+
+    int state = save_interrupt_state_and_disable();
+    if(io_rings[i].file == 1) io_ring_write(&io_rings[i]);
+    else io_ring_read(&io_rings[i]);
+    int pending = ring->sq_tail - ring->sq_head;
+    restore_interrupt_state(state);
+    return pending;
+  }
+  return -1;
+}
+
+/**
+* @brief	Carries on write requests of every ring. Called by the uart irq as the transmit buffer drains. 
+*/
+void io_ring_pump_tx() {
+  for(uint32_t i = 0; i < MAX_IO_RINGS; i++) {
+    if(io_rings[i].ring != NULL && io_rings[i].file == 1) io_ring_write(&io_rings[i]);
+  }
+}
+
+/**
+* @brief	Carries on read requests of every ring. Called by the uart irq as bytes arrive. 
+*/
+void io_ring_pump_rx() {
+  for(uint32_t i = 0; i < MAX_IO_RINGS; i++) {
+    if(io_rings[i].ring != NULL && io_rings[i].file == 0) io_ring_read(&io_rings[i]);
+  }
+}
@@ -10,8 +10,12 @@
 #include <stdint.h>
 #include "syscall_thread.h"
 #include "syscall_mutex.h"
+#include "syscall_sem.h"
+#include "syscall_event.h"
+#include "syscall_queue.h"
 #include "syscall.h"
 #include "mpu.h"
+#include "kernel_shared.h"
 #include <debug.h>
 #include <timer.h>
 #include <arm.h>
@@ -25,26 +29,43 @@
 /** @brief Interrupt return code to kernel mode using MSP.*/
 #define LR_RETURN_TO_KERNEL_MSP 0xFFFFFFF1
 
-#define MAX_TOTAL_THREADS 16 /**< Maximum total threads allowed by the system*/
-#define MAX_U_THREADS 14 /**< Maximum number of user alloated threads*/
-
 #define BUFFER_SIZE MAX_TOTAL_THREADS /**< Thread control block buffer size (in number of tcbs)*/
 #define WORD_SIZE 4 /**< System word size*/
 
 #define TCB_BUFFER_SIZE (sizeof(tcb_t) * (BUFFER_SIZE)) /**< Thread control block buffer size (in bytes)*/
 
-#define I_THREAD_SET_IDX 14 /**<Idle thread index into kernel buffers*/
-#define D_THREAD_SET_IDX 15 /**<Default thread index into kernel buffers*/
+#define I_THREAD_SET_IDX MAX_U_THREADS /**<Idle thread index into kernel buffers*/
+#define D_THREAD_SET_IDX (MAX_U_THREADS+1) /**<Default thread index into kernel buffers*/
 
-#define I_THREAD_PRIORITY 14 /**<Priority of idle thread*/
-#define D_THREAD_PRIORITY 15 /**<Priority of default thread*/
+#define I_THREAD_PRIORITY MAX_U_THREADS /**<Priority of idle thread, just below every user priority*/
+#define D_THREAD_PRIORITY (MAX_U_THREADS+1) /**<Priority of default thread*/
 
 #define INIT 0 /**< Initialization state for a thread */
 #define WAITING 1 /**< Waiting state for a thread*/
 #define RUNNABLE 2 /**< Runnable state for a thread*/
 #define RUNNING 3 /**< Running state for thread*/
+#define BLOCKED 4 /**< Blocked state for a thread waiting on a mutex, semaphore, event group or message queue*/
+
+#define MUTEX_UNLOCKED 0xFFFFFFFF /**< Locked_by value of a mutex nobody holds*/
+#define NO_MUTEX 0xFFFFFFFF /**< Wait_mutex value of a thread not blocked on a mutex*/
+#define CEIL_WORDS ((BUFFER_SIZE + 31)/32) /**< Number of words in the ceiling bitmap. Ceilings go up to the default thread's priority*/
+
+/** @brief Word of the ready/wait bitmaps holding a priority.*/
+#define PRIO_WORD(prio) ((prio) >> 5)
+/** @brief Bit representing a priority within its bitmap word. Lower priorities numbers are more significant so clz yields the highest priority.*/
+#define PRIO_BIT(prio) (0x80000000U >> ((prio) & 31))
+/** @brief Priority of the most significant set bit of bitmap word w.*/
+#define PRIO_OF(w, bits) (((w) << 5) + count_leading_zeros(bits))
+
+#ifdef BENCH
+/** @brief Number of timed scheduling decisions averaged per benchmark sample.*/
+#define BENCH_ITERATIONS 64
+#endif
 
-static volatile char blocked = 0;
+#ifdef TICKLESS
+/** @brief Set while the idle thread is default_idle, which only sleeps, so the tick may be stopped while it runs */
+static volatile char idle_sleeps = 0;
+#endif
 
 /**
  * @brief      Heap high and low pointers.
@@ -68,19 +89,28 @@ extern void default_idle();
  */
 extern void _kill();
 
+/** @brief Utilization of 1 in Q16 fixed point */
+#define Q16_ONE (1 << 16)
+
 /**
- * @brief      Precalculated values for UB test.
+ * @brief      Precalculated values for UB test in Q16 fixed point, rounded down. n(2^(1/n) - 1) for n threads.
  */
-float ub_table[] = {
-  0.000, 1.000, .8284, .7798, .7568,
-  .7435, .7348, .7286, .7241, .7205,
-  .7177, .7155, .7136, .7119, .7106,
-  .7094, .7083, .7075, .7066, .7059,
-  .7052, .7047, .7042, .7037, .7033,
-  .7028, .7025, .7021, .7018, .7015,
-  .7012, .7009
+uint32_t ub_table[] = {
+  0, 65536, 54290, 51104, 49597,
+  48726, 48155, 47749, 47454, 47218,
+  47035, 46891, 46766, 46655, 46569,
+  46491, 46419, 46366, 46307, 46261,
+  46215, 46183, 46150, 46117, 46091,
+  46058, 46039, 46012, 45993, 45973,
+  45953, 45934
 };
 
+/** @brief Number of entries in ub_table */
+#define UB_TABLE_SIZE (sizeof(ub_table)/sizeof(ub_table[0]))
+
+/** @brief Limit of the UB as the thread count grows, ln(2) in Q16 rounded down. Used past the end of ub_table. */
+#define UB_LIMIT 45426
+
 
 /* Kernel Data Structures */
 
@@ -93,6 +123,9 @@ static volatile signed char kernel_wait_set[BUFFER_SIZE] = {0};
 /** @brief Add threads to ready set once sys_thread_create is called */
 static volatile signed char kernel_ready_set[BUFFER_SIZE] = {0};
 
+/** @brief Threads leave the ready set for the blocked set while waiting on a mutex, semaphore, event group or message queue */
+static volatile signed char kernel_blocked_set[BUFFER_SIZE] = {0};
+
 /** @brief PendSV handler moves threads to running */
 //static volatile char kernel_running_set[BUFFER_SIZE] = {0};
 
@@ -102,11 +135,69 @@ static volatile tcb_t tcb_buffer[BUFFER_SIZE];
 /** @brief Static global thread id assignment */
 static volatile int thread_idx = 0;
 
-/** @brief Static global mutex locked states */
-static volatile uint32_t mutex_states = 0;
-
 /** @brief Mutex specific state */
-static volatile kmutex_t mutex_buffer[32];
+static volatile kmutex_t mutex_buffer[MAX_MUTEXES];
+
+/** @brief Number of locked mutexes at each priority ceiling */
+static volatile uint32_t ceiling_counts[BUFFER_SIZE];
+
+/** @brief Thread holding the locked mutexes at each priority ceiling. Under PCP only one thread can hold mutexes of a given ceiling at a time */
+static volatile uint8_t ceiling_holders[BUFFER_SIZE];
+
+/** @brief Number of reader holds of reader-writer locks at each priority ceiling. A level with any may have several holders */
+static volatile uint32_t ceiling_readers[BUFFER_SIZE];
+
+/** @brief Priority bitmap of the ceilings with locked mutexes, laid out like the ready bits. The most significant set bit is the system ceiling */
+static volatile uint32_t ceiling_bits[CEIL_WORDS];
+
+/** @brief Priority bitmap of the threads blocked on any mutex. The union of every mutex's waiters */
+static volatile uint32_t mutex_waiter_bits[PRIO_WORDS];
+
+/** @brief Semaphore specific state */
+static volatile ksem_t sem_buffer[MAX_SEMAPHORES];
+
+/** @brief Event group specific state */
+static volatile kevent_t event_buffer[MAX_EVENT_GROUPS];
+
+/** @brief Message queue specific state */
+static volatile kqueue_t queue_buffer[MAX_QUEUES];
+
+/** @brief Number of priority inheritance mutexes with threads blocked on them. Their holders are only searched for while there are any */
+static volatile uint32_t inherit_contended = 0;
+
+/** @brief User space block the mutex fast path reads, NULL until the first mutex registers it */
+static mutex_fast_t *fast_state = NULL;
+
+static void adopt_fast_locks(uint32_t buf_idx);
+static void release_exiting_locks(uint32_t buf_idx);
+static void publish_fast_state(uint32_t buf_idx);
+static int32_t find_inheriting_holder();
+
+/** @brief Release queue. Min-heap of user thread tcb_buffer idxs keyed by next_release */
+static volatile uint8_t release_heap[MAX_U_THREADS];
+
+/** @brief Number of threads in the release queue */
+static volatile uint32_t release_heap_size = 0;
+
+/**
+ * @brief	Computes the utilization C/T of a thread in Q16 fixed point, rounded up so admission errs on the safe side. Values of C past 16 bits are scaled down with T first so the shift cannot overflow. 
+
+ * @param[in]	C	Worst case runtime of the thread. 
+ * @param[in]	T	Period of the thread.
+
+ * @return	Utilization in Q16. Anything above 1 is reported as just over Q16_ONE, which no admission test accepts.
+ */
+static uint32_t utilization(uint32_t C, uint32_t T) {
+  if(T == 0 || C > T) return Q16_ONE + 1;
+
+  while(C >= Q16_ONE) {
+    C = (C + 1) >> 1;
+    T >>= 1;
+  }
+
+  uint32_t scaled = C << 16;
+  return scaled/T + (scaled % T != 0);
+}
 
 /**
  * @brief	Performs a UB schedulability test on a new thread being added to the task set. 
@@ -114,43 +205,418 @@ static volatile kmutex_t mutex_buffer[32];
  * @param[in]	T	Period of new Thread.
  * @param[in]	C	Worst case runtime of new thread. 
 
- * @return	0 if schedulable, -1 otherwise.
+ * @return	Non-zero if schedulable, 0 otherwise.
  */
-int ub_test(float T, float C) {
+int ub_test(uint32_t T, uint32_t C) {
    k_threading_state_t *kcb = (k_threading_state_t *)kernel_threading_state;
-   float u_tot = C/T;
+   uint32_t u_tot = utilization(C, T);
    for(int i = 0; i < MAX_U_THREADS; i++) {
       if(tcb_buffer[i].thread_state != INIT) {
          u_tot += tcb_buffer[i].U;
       }
    }
 
-   if(u_tot <= ub_table[kcb->u_thread_ct+1]) return -1;
+   uint32_t n = kcb->u_thread_ct+1;
+   if(u_tot <= ((n < UB_TABLE_SIZE) ? ub_table[n] : UB_LIMIT)) return -1;
    return 0;
 }
 
 /**
- * @brief	Updates kernel ready and waiting set structures to reflect thread states accurately.
+ * @brief	Performs the EDF schedulability test on a new thread being added to the task set. With deadlines equal to periods the set is schedulable as long as total utilization does not exceed 1.
+
+ * @param[in]	T	Period of new Thread.
+ * @param[in]	C	Worst case runtime of new thread. 
+
+ * @return	Non-zero if schedulable, 0 otherwise. Same sense as ub_test.
+ */
+int edf_test(uint32_t T, uint32_t C) {
+   uint32_t u_tot = utilization(C, T);
+   for(int i = 0; i < MAX_U_THREADS; i++) {
+      if(tcb_buffer[i].thread_state != INIT) {
+         u_tot += tcb_buffer[i].U;
+      }
+   }
+
+   return u_tot <= Q16_ONE;
+}
+
+/** @brief Timing parameters of one thread as seen by the response time analysis */
+typedef struct {
+  uint32_t prio; /**< Static priority*/
+  uint32_t C; /**< Worst case runtime*/
+  uint32_t T; /**< Period*/
+} rta_task_t;
+
+/**
+ * @brief	Reads one thread of the task set under analysis. Slots are tcb_buffer idxs, except slot max_threads which holds the thread being admitted. The set is read in place rather than copied since the kernel stack may be small.
+
+ * @param[in]	slot	Slot to read.
+ * @param[in]	new_task	Thread being admitted, NULL if none is.
+ * @param[out]	task	Parameters of the thread in the slot.
+
+ * @return	1 if the slot holds a thread, 0 otherwise.
+ */
+static int rta_task(uint32_t slot, const rta_task_t *new_task, rta_task_t *task) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  if(slot == ksb->max_threads) {
+    if(new_task == NULL) return 0;
+    *task = *new_task;
+    return 1;
+  }
+
+  if(tcb_buffer[slot].thread_state == INIT) return 0;
+
+  task->prio = tcb_buffer[slot].priority;
+  task->C = tcb_buffer[slot].C;
+  task->T = tcb_buffer[slot].T;
+  return 1;
+}
+
+/**
+ * @brief	Performs exact response time analysis on the task set, optionally with a new thread or a new mutex added. The worst case response time of every thread is found by iterating R = C + B + sum(ceil(R/Tj)*Cj) over higher priority threads j until it settles or passes the thread's period. 
+ *
+ * The blocking term B follows PCP. A thread can be blocked once by a lower priority thread holding a mutex whose ceiling is at least its priority. Critical section lengths are unknown, so the longest C of any lower priority thread is used whenever such a mutex exists. Priority inheritance mutexes may block a thread once per lower priority thread, so once any exists B is the sum of their C.
+
+ * @param[in]	new_task	Thread being admitted, NULL if none is.
+ * @param[in]	new_ceil	Ceiling of a mutex being created, NULL if none is.
+
+ * @return	Non-zero if schedulable, 0 otherwise.
+ */
+static int rta_check(const rta_task_t *new_task, const uint32_t *new_ceil) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  rta_task_t task_i, task_j;
+  uint32_t n = ksb->max_threads + 1;
+
+  //Highest ceiling over all mutexes
+  uint32_t highest_ceil = (uint32_t)-1;
+  int inherit = 0;
+  for(uint32_t m = 0; m <= ksb->u_mutex_ct; m++) {
+    uint32_t ceil;
+    if(m < ksb->u_mutex_ct) ceil = mutex_buffer[m].max_prior;
+    else if(new_ceil != NULL) ceil = *new_ceil;
+    else break;
+
+    if(ceil == MUTEX_INHERIT) inherit = 1;
+    else if(ceil < highest_ceil) highest_ceil = ceil;
+  }
+
+  for(uint32_t i = 0; i < n; i++) {
+    if(!rta_task(i, new_task, &task_i)) continue;
+
+    uint32_t b = 0;
+    if(inherit) {
+      for(uint32_t j = 0; j < n; j++) {
+        if(rta_task(j, new_task, &task_j) && task_j.prio > task_i.prio) b += task_j.C;
+      }
+    } else if(highest_ceil <= task_i.prio) {
+      for(uint32_t j = 0; j < n; j++) {
+        if(rta_task(j, new_task, &task_j) && task_j.prio > task_i.prio && task_j.C > b) b = task_j.C;
+      }
+    }
+
+    uint64_t r = (uint64_t)task_i.C + b;
+    while(r <= task_i.T) {
+      uint64_t next = (uint64_t)task_i.C + b;
+      for(uint32_t j = 0; j < n; j++) {
+        if(rta_task(j, new_task, &task_j) && task_j.prio < task_i.prio) 
+          next += (uint64_t)((uint32_t)r/task_j.T + ((uint32_t)r % task_j.T != 0)) * task_j.C;
+      }
+      if(next == r) break;
+      r = next;
+    }
+
+    if(r > task_i.T) return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * @brief	Performs exact response time analysis on the task set with a new thread added. See rta_check.
+
+ * @param[in]	priority	Priority of new thread.
+ * @param[in]	C	Worst case runtime of new thread. 
+ * @param[in]	T	Period of new thread.
+
+ * @return	Non-zero if schedulable, 0 otherwise. Same sense as ub_test.
+ */
+int rta_test(uint32_t priority, uint32_t C, uint32_t T) {
+  rta_task_t new_task = { priority, C, T };
+
+  if(T == 0) return 0;
+  return rta_check(&new_task, NULL);
+}
+
+/**
+ * @brief	Moves a thread to a new state and updates the kernel ready and waiting sets to match. Every thread state transition goes through here so the sets never need to be rebuilt. Only user threads are tracked in the sets. 
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the thread.
+ * @param[in]	state	New state of the thread.
+ */
+static void set_thread_state(uint32_t buf_idx, uint8_t state) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  int int_state = save_interrupt_state_and_disable(); //Svc handlers can be preempted by systick
+
+  tcb_buffer[buf_idx].thread_state = state;
+  if(state == WAITING || state == BLOCKED) tcb_buffer[buf_idx].block_ct++;
+
+  if(buf_idx < ksb->max_threads) {
+    uint32_t set_idx = tcb_buffer[buf_idx].priority;
+
+    switch(state) {
+      case WAITING:
+        ksb->ready_set[set_idx] = -1;
+        ksb->wait_set[set_idx] = buf_idx;
+        ksb->blocked_set[set_idx] = -1;
+        ksb->ready_bits[PRIO_WORD(set_idx)] &= ~PRIO_BIT(set_idx);
+        ksb->wait_bits[PRIO_WORD(set_idx)] |= PRIO_BIT(set_idx);
+        ksb->blocked_bits[PRIO_WORD(set_idx)] &= ~PRIO_BIT(set_idx);
+        break;
+
+      case RUNNING:
+      case RUNNABLE:
+        ksb->ready_set[set_idx] = buf_idx;
+        ksb->wait_set[set_idx] = -1;
+        ksb->blocked_set[set_idx] = -1;
+        ksb->ready_bits[PRIO_WORD(set_idx)] |= PRIO_BIT(set_idx);
+        ksb->wait_bits[PRIO_WORD(set_idx)] &= ~PRIO_BIT(set_idx);
+        ksb->blocked_bits[PRIO_WORD(set_idx)] &= ~PRIO_BIT(set_idx);
+        break;
+
+      case BLOCKED:
+        ksb->ready_set[set_idx] = -1;
+        ksb->wait_set[set_idx] = -1;
+        ksb->blocked_set[set_idx] = buf_idx;
+        ksb->ready_bits[PRIO_WORD(set_idx)] &= ~PRIO_BIT(set_idx);
+        ksb->wait_bits[PRIO_WORD(set_idx)] &= ~PRIO_BIT(set_idx);
+        ksb->blocked_bits[PRIO_WORD(set_idx)] |= PRIO_BIT(set_idx);
+        break;
+
+      default: //INIT, thread no longer exists
+        ksb->ready_set[set_idx] = -1;
+        ksb->wait_set[set_idx] = -1;
+        ksb->blocked_set[set_idx] = -1;
+        ksb->ready_bits[PRIO_WORD(set_idx)] &= ~PRIO_BIT(set_idx);
+        ksb->wait_bits[PRIO_WORD(set_idx)] &= ~PRIO_BIT(set_idx);
+        ksb->blocked_bits[PRIO_WORD(set_idx)] &= ~PRIO_BIT(set_idx);
+        break;
+    }
+  }
+
+  restore_interrupt_state(int_state);
+}
+
+#ifdef DEBUG
+/**
+ * @brief	Rebuilds the kernel ready and waiting sets from thread states and asserts that they match the incrementally maintained sets.
  */
-void update_kernel_sets() {
+static void check_kernel_sets() {
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  uint32_t ready_bits[PRIO_WORDS] = {0};
+  uint32_t wait_bits[PRIO_WORDS] = {0};
+  uint32_t blocked_bits[PRIO_WORDS] = {0};
 
   for(uint32_t i = 0; i < ksb->max_threads; i++) {
-    int8_t cur_set_idx = tcb_buffer[i].priority;
+    uint32_t set_idx = tcb_buffer[i].priority;
 
     switch(tcb_buffer[i].thread_state) {
       case WAITING:
-        ksb->ready_set[cur_set_idx] = -1;
-        ksb->wait_set[cur_set_idx] = i;
+        ASSERT(ksb->wait_set[set_idx] == (signed char)i);
+        wait_bits[PRIO_WORD(set_idx)] |= PRIO_BIT(set_idx);
         break;
-      
+
       case RUNNING:
       case RUNNABLE:
-        ksb->ready_set[cur_set_idx] = i;
-        ksb->wait_set[cur_set_idx] = -1; 
+        ASSERT(ksb->ready_set[set_idx] == (signed char)i);
+        ready_bits[PRIO_WORD(set_idx)] |= PRIO_BIT(set_idx);
+        break;
+
+      case BLOCKED:
+        ASSERT(ksb->blocked_set[set_idx] == (signed char)i);
+        blocked_bits[PRIO_WORD(set_idx)] |= PRIO_BIT(set_idx);
         break;
     }
   }
+
+  for(uint32_t w = 0; w < PRIO_WORDS; w++) {
+    ASSERT(ksb->ready_bits[w] == ready_bits[w]);
+    ASSERT(ksb->wait_bits[w] == wait_bits[w]);
+    ASSERT(ksb->blocked_bits[w] == blocked_bits[w]);
+  }
+}
+#endif
+
+/**
+ * @brief	Finds the next thread to run in constant time. The highest priority ready thread is found with a single clz on the ready bitmap.
+
+ * @return	Tcb_buffer idx of the highest priority ready thread. If the ready set is empty, the idle thread if threads are waiting or blocked, otherwise the default thread. 
+ */
+static int32_t highest_priority_thread() {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  uint32_t waiting = 0;
+
+  for(uint32_t w = 0; w < PRIO_WORDS; w++) {
+    if(ksb->ready_bits[w]) 
+      return ksb->ready_set[PRIO_OF(w, ksb->ready_bits[w])];
+    waiting |= ksb->wait_bits[w] | ksb->blocked_bits[w];
+  }
+
+  if(waiting) //Swap to idle, tasks in waiting set
+    return ksb->max_threads;
+
+  return ksb->max_threads+1; //Swap to default thread, nothing in waiting set
+}
+
+/**
+ * @brief	Finds the ready thread with the earliest absolute deadline. Deadlines equal periods, so a thread's deadline is its next release. Ties go to the higher priority thread. 
+
+ * @return	Tcb_buffer idx of the ready thread with the earliest deadline. If the ready set is empty, the same fallback as highest_priority_thread(). 
+ */
+static int32_t earliest_deadline_thread() {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  int32_t earliest = -1;
+
+  for(uint32_t w = 0; w < PRIO_WORDS; w++) {
+    uint32_t ready_bits = ksb->ready_bits[w];
+
+    while(ready_bits) {
+      uint32_t prio = PRIO_OF(w, ready_bits);
+      int32_t buf_idx = ksb->ready_set[prio];
+      ready_bits &= ~PRIO_BIT(prio);
+
+      if(earliest < 0 || (int32_t)(tcb_buffer[buf_idx].next_release - tcb_buffer[earliest].next_release) < 0)
+        earliest = buf_idx;
+    }
+  }
+
+  if(earliest < 0) return highest_priority_thread();
+  return earliest;
+}
+
+/**
+ * @brief	Checks whether a mutex holder may be dispatched in place of the thread picked by the scheduler. A holder that has yielded stays off the cpu until its next release.
+
+ * @return	1 if the thread is running or runnable, 0 otherwise.
+ */
+static int lock_holder_ready(int32_t buf_idx) {
+  uint8_t state = tcb_buffer[buf_idx].thread_state;
+  return state == RUNNING || state == RUNNABLE;
+}
+
+#ifdef BENCH
+/**
+ * @brief	Times highest_priority_thread() with 1 to MAX_U_THREADS threads in the ready set and prints the average cycle count of each. Only the lowest priorities are filled, which is the worst case for a linear scan. The kernel sets are restored afterwards.
+ */
+static void bench_dispatch() {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  uint32_t ready_bits[PRIO_WORDS];
+  signed char ready_set[MAX_U_THREADS];
+  volatile int32_t next; //Keeps the timed calls from being optimized out
+
+  for(int i = 0; i < MAX_U_THREADS; i++) 
+    ready_set[i] = ksb->ready_set[i];
+  for(int w = 0; w < PRIO_WORDS; w++) {
+    ready_bits[w] = ksb->ready_bits[w];
+    ksb->ready_bits[w] = 0;
+  }
+
+  enable_cycle_counter();
+  for(int n = 1; n <= MAX_U_THREADS; n++) {
+    ksb->ready_set[MAX_U_THREADS-n] = 0;
+    ksb->ready_bits[PRIO_WORD(MAX_U_THREADS-n)] |= PRIO_BIT(MAX_U_THREADS-n);
+
+    uint32_t start = read_cycle_counter();
+    for(int i = 0; i < BENCH_ITERATIONS; i++) 
+      next = highest_priority_thread();
+    uint32_t cycles = read_cycle_counter() - start;
+
+    printk("dispatch: %d threads, %u cycles, next %d\n", n, cycles/BENCH_ITERATIONS, next);
+  }
+
+  for(int i = 0; i < MAX_U_THREADS; i++) 
+    ksb->ready_set[i] = ready_set[i];
+  for(int w = 0; w < PRIO_WORDS; w++) 
+    ksb->ready_bits[w] = ready_bits[w];
+}
+#endif
+
+/**
+ * @brief	Compares the next release times of two threads. Tick counts are compared by signed difference so the queue keeps working across sys_tick_ct wraparound.
+
+ * @return	1 if thread a is released strictly before thread b, 0 otherwise.
+ */
+static int released_before(uint32_t a, uint32_t b) {
+  return (int32_t)(tcb_buffer[a].next_release - tcb_buffer[b].next_release) < 0;
+}
+
+/**
+ * @brief	Moves the release queue entry at pos towards the root until the heap property holds.
+ */
+static void release_sift_up(uint32_t pos) {
+  uint8_t buf_idx = release_heap[pos];
+
+  while(pos > 0) {
+    uint32_t parent = (pos-1)/2;
+    if(!released_before(buf_idx, release_heap[parent])) break;
+    release_heap[pos] = release_heap[parent];
+    pos = parent;
+  }
+  release_heap[pos] = buf_idx;
+}
+
+/**
+ * @brief	Moves the release queue entry at pos towards the leaves until the heap property holds.
+ */
+static void release_sift_down(uint32_t pos) {
+  uint8_t buf_idx = release_heap[pos];
+
+  while(1) {
+    uint32_t child = 2*pos+1;
+    if(child >= release_heap_size) break;
+    if(child+1 < release_heap_size && released_before(release_heap[child+1], release_heap[child])) 
+      child++;
+    if(!released_before(release_heap[child], buf_idx)) break;
+    release_heap[pos] = release_heap[child];
+    pos = child;
+  }
+  release_heap[pos] = buf_idx;
+}
+
+/**
+ * @brief	Adds a thread to the release queue. Its next_release must already be set.
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the thread.
+ */
+static void release_queue_insert(uint32_t buf_idx) {
+  int int_state = save_interrupt_state_and_disable(); //Svc handlers can be preempted by systick
+
+  release_heap[release_heap_size] = buf_idx;
+  release_sift_up(release_heap_size++);
+
+  restore_interrupt_state(int_state);
+}
+
+/**
+ * @brief	Removes a thread from the release queue. Only used when a thread is killed so a linear search for its position is fine.
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the thread.
+ */
+static void release_queue_remove(uint32_t buf_idx) {
+  int int_state = save_interrupt_state_and_disable();
+
+  for(uint32_t pos = 0; pos < release_heap_size; pos++) {
+    if(release_heap[pos] != buf_idx) continue;
+
+    release_heap[pos] = release_heap[--release_heap_size];
+    if(pos < release_heap_size) {
+      release_sift_up(pos);
+      release_sift_down(pos);
+    }
+    break;
+  }
+
+  restore_interrupt_state(int_state);
 }
 
 /**
@@ -165,23 +631,47 @@ void update_thread_states(uint8_t curr_thread) {
   if(tcb_buffer[curr_thread].duration >= tcb_buffer[curr_thread].C) {
 
     if(curr_thread < ksb->max_threads) { //Only user threads can be downgraded
-      tcb_buffer[curr_thread].thread_state = WAITING;
+      adopt_fast_locks(curr_thread); //Others may run while it waits
+      set_thread_state(curr_thread, WAITING);
     }
   }
 
-  //Update booking for each allocated thread
-  for(uint8_t i = 0; i < ksb->max_threads; i++) {
-    if(tcb_buffer[i].thread_state != INIT) {
-      tcb_buffer[i].period_ct++;
-      if(tcb_buffer[i].period_ct >= tcb_buffer[i].T) {
-         tcb_buffer[i].period_ct = 0;
-         tcb_buffer[i].duration = 0;
-         tcb_buffer[i].thread_state = RUNNABLE;
-      }
-    }
+  //Release every thread whose period begins this tick. Only the head of the queue needs checking otherwise
+  while(release_heap_size > 0) {
+    uint8_t i = release_heap[0];
+    if((int32_t)(ksb->sys_tick_ct - tcb_buffer[i].next_release) < 0) break;
+
+    tcb_buffer[i].next_release += tcb_buffer[i].T; //Relative to the release, not to now, so periods never drift
+    tcb_buffer[i].duration = 0;
+    if(tcb_buffer[i].thread_state == WAITING) set_thread_state(i, RUNNABLE);
+    release_sift_down(0);
   }
 }
 
+/**
+ * @brief	Copies the tick count and a thread's cpu time to the shared page.
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the thread whose time changed.
+ */
+static void publish_time(uint32_t buf_idx) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  KERNEL_SHARED->sys_tick_ct = ksb->sys_tick_ct;
+  KERNEL_SHARED->thread_time[buf_idx] = tcb_buffer[buf_idx].total_time;
+}
+
+/**
+ * @brief	Clears the shared page and publishes the running thread. Called at boot, before user space can read the page, and whenever the thread library is reinitialized.
+ */
+void shared_page_init() {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  KERNEL_SHARED->sys_tick_ct = ksb->sys_tick_ct;
+  KERNEL_SHARED->running_thread = ksb->running_thread;
+  for(int i = 0; i < MAX_TOTAL_THREADS; i++) 
+    KERNEL_SHARED->thread_time[i] = 0;
+}
+
 /**
 * @brief	Handler called on occassion of sys-tick interrupt. Will call necessary functions to update thread states and then triggers a pendsv interrupt to run the scheduler. 
 
@@ -189,11 +679,17 @@ void update_thread_states(uint8_t curr_thread) {
 void systick_c_handler() {
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
 
-  ksb->sys_tick_ct++;
+  uint32_t ticks = 1;
+#ifdef TICKLESS
+  ticks += timer_unstretch(); //Catch up on the ticks skipped while idle
+#endif
+
+  ksb->sys_tick_ct += ticks;
 
   uint8_t curr_thread = ksb->running_thread;
-  tcb_buffer[curr_thread].duration++;
-  tcb_buffer[curr_thread].total_time++;
+  tcb_buffer[curr_thread].duration += ticks;
+  tcb_buffer[curr_thread].total_time += ticks;
+  publish_time(curr_thread);
 
   update_thread_states(curr_thread);  
 
@@ -201,6 +697,27 @@ void systick_c_handler() {
   return;
 }
 
+#ifdef TICKLESS
+/**
+ * @brief	Reprograms systick for the thread about to be dispatched. Any stretched tick is ended and sys_tick_ct caught up. If the next thread is a sleeping idle thread, systick is stretched to the next release since nothing can happen before then. User threads always run with a regular tick, as their budgets and spin waits are counted in ticks.
+
+ * @param[in]	next_buf_idx	Tcb_buffer idx of the thread about to run.
+ */
+static void tickless_dispatch(uint32_t next_buf_idx) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  uint32_t skipped = timer_unstretch();
+  ksb->sys_tick_ct += skipped;
+  tcb_buffer[ksb->max_threads].total_time += skipped;
+  publish_time(ksb->max_threads);
+
+  if(next_buf_idx != ksb->max_threads || !idle_sleeps || !release_heap_size) return;
+
+  int32_t ticks = tcb_buffer[release_heap[0]].next_release - ksb->sys_tick_ct;
+  if(ticks > 1) timer_stretch(ticks);
+}
+#endif
+
 /**
  * @brief	Implementation of round robin scheduler
 
@@ -246,13 +763,14 @@ void *round_robin(void *curr_context_ptr) {
   }
 
   //Remove new running task from ready set
-  tcb_buffer[running_buf_idx].thread_state = RUNNING;
+  set_thread_state(running_buf_idx, RUNNING);
   
   //Add old back task back to ready set
-  tcb_buffer[old_running_buf_idx].thread_state = RUNNABLE;
+  set_thread_state(old_running_buf_idx, RUNNABLE);
  
   //Set new running thread 
   ksb->running_thread = running_buf_idx;
+  KERNEL_SHARED->running_thread = running_buf_idx;
 
   //Restore status and return new context pointer
   set_svc_status(tcb_buffer[running_buf_idx].svc_state);
@@ -261,13 +779,13 @@ void *round_robin(void *curr_context_ptr) {
 }
 
 /**
- * @brief	RMS scheduler implementation. 
+ * @brief	Fixed priority scheduler implementation, shared by RMS and PCP. The policies only differ in admission and in the ceiling checks made at lock time, so both dispatch the same way. 
  
  * @param[in]	curr_context_ptr	Pointer to the stack saved context fo the current thread. 
 
- * @return	A pointer to the stack-saved context of the next thread to be run as determined by the RMS algorithm. 
+ * @return	A pointer to the stack-saved context of the next thread to be run by fixed priority. 
  */
-void *rms(void *curr_context_ptr) { 
+void *fixed_prio(void *curr_context_ptr) { 
   
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
 
@@ -280,75 +798,52 @@ void *rms(void *curr_context_ptr) {
   
   int32_t old_running_buf_idx = running_buf_idx;
 
-  int ready_idx = 0;
-  
-  for(; ready_idx < MAX_U_THREADS; ready_idx++) {//Search for highest priority RUNNABLE task 
-    int curr_buf_idx = ksb->ready_set[ready_idx];
+  running_buf_idx = highest_priority_thread();
 
-    if(curr_buf_idx > -1) { //Found 
-      running_buf_idx = curr_buf_idx;
-      break;
-    }
-  }
-  
-  
-  if(ready_idx == MAX_U_THREADS) { //Special case, nothing found in ready set
-    uint8_t waiting = 0;  
-    for(int i = 0; i < MAX_U_THREADS; i++) { //Check waiting set
-      if(ksb->wait_set[i] > -1) {
-        waiting = 1; 
-        break;
-      }
-    }
-    
-    if(!waiting) { //Swap to default thread, nothing in waiting set
-      running_buf_idx = ksb->max_threads+1;
-    } else { //Swap to idle, tasks in waiting set
-      running_buf_idx = ksb->max_threads;
-    } 
-  }
+  //Let the holder of the system ceiling run at the priority inherited from the threads blocked on it
+  int32_t locker = find_highest_locker();
+  if(locker > -1 && lock_holder_ready(locker) && tcb_buffer[locker].inherited_prior < tcb_buffer[running_buf_idx].priority)
+    running_buf_idx = locker;
 
-  if(blocked) {
-    blocked = 0;
-    running_buf_idx = find_highest_locker();
-  }
+  //Likewise the holder of a priority inheritance mutex, at the priority it inherited through its chain of waiters
+  int32_t inheritor = find_inheriting_holder();
+  if(inheritor > -1 && tcb_buffer[inheritor].inherited_prior < tcb_buffer[running_buf_idx].inherited_prior)
+    running_buf_idx = inheritor;
+
+#ifdef TICKLESS
+  tickless_dispatch(running_buf_idx);
+#endif
 
   //Remove new running task from ready set
-  tcb_buffer[running_buf_idx].thread_state = RUNNING;
+  set_thread_state(running_buf_idx, RUNNING);
 
   //If the current thread didn't yield (was just RUNNING or RUNNABLE), add old task back to ready set
-  if(running_thread_state > WAITING) 
-    tcb_buffer[old_running_buf_idx].thread_state = RUNNABLE;
+  if(running_thread_state == RUNNING || running_thread_state == RUNNABLE) 
+    set_thread_state(old_running_buf_idx, RUNNABLE);
 
   //Set new running thread 
   ksb->running_thread = running_buf_idx;
+  KERNEL_SHARED->running_thread = running_buf_idx;
     
   //Restore status and return new context pointer
   set_svc_status(tcb_buffer[running_buf_idx].svc_state);
+  publish_fast_state(running_buf_idx);
 
-  protection_mode prot_mode = ksb->mem_prot;
-
-  void *user_stack_ptr = tcb_buffer[ksb->running_thread].user_stack_ptr;
-  void *kernel_stack_ptr = tcb_buffer[ksb->running_thread].kernel_stack_ptr;
-
-  if(prot_mode == KERNEL_ONLY) {
-    mm_enable_user_stacks(user_stack_ptr, kernel_stack_ptr, -1);
-  } else {
-    mm_disable_user_stacks();
-    mm_enable_user_stacks(user_stack_ptr, kernel_stack_ptr, ksb->running_thread);
-  }
+  //Kernel only regions never change, per thread regions only change with the thread
+  if(ksb->mem_prot == PER_THREAD && running_buf_idx != old_running_buf_idx)
+    mm_load_user_stacks(tcb_buffer[running_buf_idx].stack_regions);
 
   return tcb_buffer[running_buf_idx].kernel_stack_ptr;
 }
 
 /**
- * @brief	PCP scheduler implementation. 
+ * @brief	EDF scheduler implementation. 
  
  * @param[in]	curr_context_ptr	Pointer to the stack saved context fo the current thread. 
 
- * @return	A pointer to the stack-saved context of the next thread to be run as determined by the PCP algorithm. 
+ * @return	A pointer to the stack-saved context of the next thread to be run as determined by the EDF algorithm. 
  */
-void *pcp(void *curr_context_ptr) { 
+void *edf(void *curr_context_ptr) { 
   
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
 
@@ -361,64 +856,41 @@ void *pcp(void *curr_context_ptr) {
   
   int32_t old_running_buf_idx = running_buf_idx;
 
-  int ready_idx = 0;
-  
-  for(; ready_idx < MAX_U_THREADS; ready_idx++) {//Search for highest priority RUNNABLE task 
-    int curr_buf_idx = ksb->ready_set[ready_idx];
+  running_buf_idx = earliest_deadline_thread();
 
-    if(curr_buf_idx > -1) { //Found 
-      running_buf_idx = curr_buf_idx;
-      break;
-    }
-  }
-  
-  
-  if(ready_idx == MAX_U_THREADS) { //Special case, nothing found in ready set
-    uint8_t waiting = 0;  
-    for(int i = 0; i < MAX_U_THREADS; i++) { //Check waiting set
-      if(ksb->wait_set[i] > -1) {
-        waiting = 1; 
-        break;
-      }
-    }
-    
-    if(!waiting) { //Swap to default thread, nothing in waiting set
-      running_buf_idx = ksb->max_threads+1;
-    } else { //Swap to idle, tasks in waiting set
-      running_buf_idx = ksb->max_threads;
-    } 
-  }
+  //Let the holder of a contended mutex run ahead of every deadline while threads are blocked on it
+  int32_t locker = find_highest_locker();
+  if(locker > -1 && lock_holder_ready(locker) && tcb_buffer[locker].inherited_prior < tcb_buffer[locker].priority)
+    running_buf_idx = locker;
 
-  if((uint32_t)running_buf_idx >= (uint32_t)ksb->priority_ceiling && tcb_buffer[running_buf_idx].blocked) {
-    running_buf_idx = find_highest_locker();
-  }
+  //Likewise the holder of a contended priority inheritance mutex
+  int32_t inheritor = find_inheriting_holder();
+  if(inheritor > -1 && (running_buf_idx != locker || tcb_buffer[inheritor].inherited_prior < tcb_buffer[locker].inherited_prior))
+    running_buf_idx = inheritor;
+
+#ifdef TICKLESS
+  tickless_dispatch(running_buf_idx);
+#endif
 
   //Remove new running task from ready set
-  tcb_buffer[running_buf_idx].thread_state = RUNNING;
+  set_thread_state(running_buf_idx, RUNNING);
 
   //If the current thread didn't yield (was just RUNNING or RUNNABLE), add old task back to ready set
-  if(running_thread_state > WAITING) 
-    tcb_buffer[old_running_buf_idx].thread_state = RUNNABLE;
+  if(running_thread_state == RUNNING || running_thread_state == RUNNABLE) 
+    set_thread_state(old_running_buf_idx, RUNNABLE);
 
   //Set new running thread 
   ksb->running_thread = running_buf_idx;
+  KERNEL_SHARED->running_thread = running_buf_idx;
     
   //Restore status and return new context pointer
   set_svc_status(tcb_buffer[running_buf_idx].svc_state);
+  publish_fast_state(running_buf_idx);
 
-  protection_mode prot_mode = ksb->mem_prot;
-
-  void *user_stack_ptr = tcb_buffer[ksb->running_thread].user_stack_ptr;
-  void *kernel_stack_ptr = tcb_buffer[ksb->running_thread].kernel_stack_ptr;
+  //Kernel only regions never change, per thread regions only change with the thread
+  if(ksb->mem_prot == PER_THREAD && running_buf_idx != old_running_buf_idx)
+    mm_load_user_stacks(tcb_buffer[running_buf_idx].stack_regions);
 
-  if(prot_mode == KERNEL_ONLY) {
-    mm_enable_user_stacks(user_stack_ptr, kernel_stack_ptr, -1);
-  } else {
-    mm_disable_user_stacks();
-    mm_enable_user_stacks(user_stack_ptr, kernel_stack_ptr, ksb->running_thread);
-  }
-
-  tcb_buffer[running_buf_idx].blocked = 0;
   return tcb_buffer[running_buf_idx].kernel_stack_ptr;
 }
 
@@ -430,22 +902,36 @@ void *pcp(void *curr_context_ptr) {
  * @return	A pointer to the next thread's stack-saved context. 
  */
 void *pendsv_c_handler(void *context_ptr) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
 
-  update_kernel_sets(); //Update waiting and ready sets
+  //Record whether _pend_sv_ stacked fpu registers for the outgoing thread
+  tcb_buffer[ksb->running_thread].fpu_used = !(((thread_stack_frame *)context_ptr)->r14 & EXC_RETURN_STD_FRAME);
+
+#ifdef DEBUG
+  check_kernel_sets(); //Incremental sets must match a full rebuild
+#endif
+
+  switch(ksb->sched_policy) {
+    case SCHED_EDF:
+      context_ptr = edf(context_ptr);
+      break;
+
+    default: //SCHED_RMS and SCHED_PCP
+      context_ptr = fixed_prio(context_ptr);
+      break;
+  }
 
-  //context_ptr = rms(context_ptr);
-  context_ptr = pcp(context_ptr);
   return context_ptr;
 }
 
 /** 
  * @brief	System call to initialize a new thread. 
  
- * @param[in]	max_threads	Maximum number of user threads. Cannot be great than 14. 
+ * @param[in]	max_threads	Maximum number of user threads. Cannot be greater than MAX_U_THREADS. 
  * @param[in]	stack_size	Stack size for each thread in bytes. 
  * @param[in]	idle_fn	Idle function to be used by scheduler. If NULL a default one shall be utilized. 
- * @param[in]	memory_protection	UNUSED
- * @param[in]	max_mutexes	UNUSED
+ * @param[in]	memory_protection	KERNEL_ONLY or PER_THREAD, OR'd with the SCHED_ policy to use and optionally SCHED_RTA. 
+ * @param[in]	max_mutexes	Maximum number of mutexes. Cannot be greater than MAX_MUTEXES. 
 
  * @return	0 on success -1 otherwise. 
  */
@@ -457,9 +943,14 @@ int sys_thread_init(
   uint32_t max_mutexes
 ){
   
-  //User can only allocate up to and including 14 threads
+  //User can only allocate up to and including MAX_U_THREADS threads
   if(max_threads > MAX_U_THREADS) return -1;
 
+  if(max_mutexes > MAX_MUTEXES) return -1;
+
+  uint32_t sched_policy = memory_protection & SCHED_POLICY_MASK;
+  if(sched_policy > SCHED_EDF) return -1;
+
   k_threading_state_t *ksb;
   
   /* Check if proposed stack size can fit in kernel/user stack space */
@@ -480,10 +971,27 @@ int sys_thread_init(
   for(int i = 0; i < BUFFER_SIZE; i++) {
     kernel_wait_set[i] = -1;
     kernel_ready_set[i] = -1;
+    kernel_blocked_set[i] = -1;
   }
 
   ksb->wait_set = (signed char *)kernel_wait_set;
   ksb->ready_set = (signed char *)kernel_ready_set;
+  ksb->blocked_set = (signed char *)kernel_blocked_set;
+  for(int w = 0; w < PRIO_WORDS; w++) {
+    ksb->wait_bits[w] = 0;
+    ksb->ready_bits[w] = 0;
+    ksb->blocked_bits[w] = 0;
+    mutex_waiter_bits[w] = 0;
+  }
+  for(int i = 0; i < BUFFER_SIZE; i++) {
+    ceiling_counts[i] = 0;
+    ceiling_readers[i] = 0;
+  }
+  fast_state = NULL;
+  inherit_contended = 0;
+  for(int w = 0; w < CEIL_WORDS; w++) 
+    ceiling_bits[w] = 0;
+  release_heap_size = 0;
 
   //Default thread idx is always +1 of the maximum number of max user threads
   ksb->running_thread = max_threads+1;
@@ -491,12 +999,18 @@ int sys_thread_init(
   ksb->sys_tick_ct = 0;
   ksb->u_thread_ct = 0;
   ksb->u_mutex_ct = 0;
+  ksb->u_sem_ct = 0;
+  ksb->u_event_ct = 0;
+  ksb->u_queue_ct = 0;
+  shared_page_init();
   ksb->priority_ceiling = -1;
 
   ksb->stack_size = stack_size_bytes;
   ksb->max_threads = max_threads;
   ksb->max_mutexes = max_mutexes;
-  ksb->mem_prot = memory_protection;
+  ksb->mem_prot = memory_protection & PROT_MODE_MASK;
+  ksb->sched_policy = sched_policy;
+  ksb->rta_admission = (memory_protection & SCHED_RTA) ? 1 : 0;
 
   uint32_t user_stack_brk = (uint32_t)&__thread_u_stacks_top;
   uint32_t kernel_stack_brk = (uint32_t)&__thread_k_stacks_top;
@@ -510,7 +1024,7 @@ int sys_thread_init(
      tcb_buffer[i].thread_state = INIT;
      tcb_buffer[i].svc_state = 0;
      tcb_buffer[i].U = 0;
-     tcb_buffer[i].blocked = 0;
+     tcb_buffer[i].locks_held = 0;
   }
 
   ksb->thread_u_stacks_bottom = (void *)&__thread_u_stacks_low;
@@ -520,21 +1034,23 @@ int sys_thread_init(
   uint8_t i_thread_buf_idx = ksb->max_threads;
   uint8_t d_thread_buf_idx = ksb->max_threads+1;
 
-  /* Set kernel state for idle thread 14 */
+  /* Set kernel state for idle thread */
   tcb_buffer[i_thread_buf_idx].user_stack_ptr = (void *)user_stack_brk;
   tcb_buffer[i_thread_buf_idx].kernel_stack_ptr = (void *)kernel_stack_brk;
   tcb_buffer[i_thread_buf_idx].U = 0;
   tcb_buffer[i_thread_buf_idx].thread_state = WAITING;
-  tcb_buffer[i_thread_buf_idx].blocked = 0;
   
 
-  /* Set kernel state for default thread 15 */
+  /* Set kernel state for default thread */
   tcb_buffer[d_thread_buf_idx].thread_state = RUNNABLE;
   tcb_buffer[d_thread_buf_idx].svc_state = 0;
   tcb_buffer[d_thread_buf_idx].U = 0;
   tcb_buffer[d_thread_buf_idx].priority = D_THREAD_PRIORITY;
   tcb_buffer[d_thread_buf_idx].inherited_prior = D_THREAD_PRIORITY;
-  tcb_buffer[d_thread_buf_idx].blocked = 0;
+  tcb_buffer[d_thread_buf_idx].locks_held = 0;
+  tcb_buffer[d_thread_buf_idx].wait_mutex = NO_MUTEX;
+  tcb_buffer[d_thread_buf_idx].block_ct = 0;
+  mm_build_user_stacks(tcb_buffer[d_thread_buf_idx].stack_regions, d_thread_buf_idx);
 
   /* Move idle thread to runnable*/
   if(idle_fn == NULL) {
@@ -550,7 +1066,7 @@ int sys_thread_init(
 extern void thread_kill(void);
 
 /**
- * @brief	System call to spawn a new thread. Schedulability verified using UB test. 
+ * @brief	System call to spawn a new thread. Schedulability verified using UB test, response time analysis if SCHED_RTA was given, or the utilization bound of 1 under EDF. 
  
  * @param[in]	fn	Function to be executed by new thread. 
  * @param[in]	priority	Priority of new thread. 
@@ -567,13 +1083,24 @@ int sys_thread_create(
   uint32_t T,
   void *vargp
 ){
-  if(!ub_test((float)T, (float)C)) return -1;
+  //Priorities index the ready/wait sets, only the idle thread may sit past the user priorities
+  if(priority >= MAX_U_THREADS && priority != I_THREAD_PRIORITY) return -1;
+
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
 
+  if(ksb->sched_policy == SCHED_EDF) {
+    if(!edf_test(T, C)) return -1;
+  } else if(ksb->rta_admission) {
+    if(priority != I_THREAD_PRIORITY && !rta_test(priority, C, T)) return -1;
+  } else if(!ub_test(T, C)) return -1;
+
   uint8_t new_buf_idx;
   if(priority == I_THREAD_PRIORITY) { //Idle thread alloc
 
     new_buf_idx = ksb->max_threads;
+#ifdef TICKLESS
+    idle_sleeps = (fn == (void *)&default_idle);
+#endif
 
   } else { //Normal user thread
 
@@ -623,14 +1150,19 @@ int sys_thread_create(
   tcb_buffer[new_buf_idx].kernel_stack_ptr = (void *)kernel_stack_ptr;
   tcb_buffer[new_buf_idx].C = C;
   tcb_buffer[new_buf_idx].T = T;
-  tcb_buffer[new_buf_idx].U = (float)C/(float)T;
-  tcb_buffer[new_buf_idx].thread_state = RUNNABLE;
+  tcb_buffer[new_buf_idx].U = utilization(C, T);
   tcb_buffer[new_buf_idx].priority = priority;
   tcb_buffer[new_buf_idx].inherited_prior = priority;
-  tcb_buffer[new_buf_idx].period_ct = 0;
+  tcb_buffer[new_buf_idx].next_release = ksb->sys_tick_ct + T;
   tcb_buffer[new_buf_idx].duration = 0;
   tcb_buffer[new_buf_idx].total_time = 0;
+  KERNEL_SHARED->thread_time[new_buf_idx] = 0;
   tcb_buffer[new_buf_idx].svc_state = 0;
+  tcb_buffer[new_buf_idx].fpu_used = 0;
+  tcb_buffer[new_buf_idx].locks_held = 0;
+  tcb_buffer[new_buf_idx].block_ct = 0;
+  tcb_buffer[new_buf_idx].wait_mutex = NO_MUTEX;
+  if(mm_build_user_stacks(tcb_buffer[new_buf_idx].stack_regions, new_buf_idx)) return -1;
   
   //Initialize kernel stack frame
   thread_frame->psp = user_stack_ptr;
@@ -644,6 +1176,9 @@ int sys_thread_create(
   thread_frame->r11 = 0;
   thread_frame->r14 = LR_RETURN_TO_USER_PSP;
 
+  set_thread_state(new_buf_idx, RUNNABLE);
+  if(priority != I_THREAD_PRIORITY) release_queue_insert(new_buf_idx);
+
   //Only count new user threads in count
   if(priority != I_THREAD_PRIORITY) ksb->u_thread_ct++;
     
@@ -661,8 +1196,21 @@ int sys_scheduler_start( uint32_t frequency ){
   uint32_t timer_period = CPU_CLK_FREQ/frequency;
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
   ksb -> sys_tick_ct = 0;
+  KERNEL_SHARED->sys_tick_ct = 0;
+
+#ifdef BENCH
+  bench_dispatch();
+#endif
+
   if(timer_start(timer_period)) return -1;
 
+  //Kernel only regions are shared by every thread, so they are loaded once here
+  if(ksb->mem_prot == KERNEL_ONLY) {
+    mpu_region_t stack_regions[2];
+    if(mm_build_user_stacks(stack_regions, -1)) return -1;
+    mm_load_user_stacks(stack_regions);
+  }
+
   pend_pendsv(); //Begin first thread
   return 0;
 }
@@ -699,12 +1247,56 @@ uint32_t sys_thread_time(){
   return tcb_buffer[ksb->running_thread].total_time;
 }
 
+/** 
+ * @brief	Returns how often the running thread was made to wait or block so far. Syscall batches compare it around each operation.
+
+ * @return	Block count of the running thread.
+ */
+uint32_t get_block_ct(){
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  return tcb_buffer[ksb->running_thread].block_ct;
+}
+
+/** 
+ * @brief	Returns the tcb_buffer idx of the running thread.
+
+ * @return	Tcb_buffer idx of the running thread.
+ */
+uint32_t get_running_thread(){
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  return ksb->running_thread;
+}
+
+/** 
+ * @brief	Checks that a thread could access a range of memory itself, whichever thread is running. Safe from interrupts.
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the thread.
+ * @param[in]	ptr	Start of the range.
+ * @param[in]	len	Bytes in the range.
+ * @param[in]	write	Non-zero if the range is written.
+
+ * @return	1 if the thread can access every byte, 0 otherwise.
+ */
+int thread_can_access(uint32_t buf_idx, const void *ptr, uint32_t len, int write){
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  if(ksb->mem_prot == PER_THREAD)
+    return mm_user_can_access(tcb_buffer[buf_idx].stack_regions, ptr, len, write);
+
+  mpu_region_t stack_regions[2];
+  if(mm_build_user_stacks(stack_regions, -1)) return 0;
+  return mm_user_can_access(stack_regions, ptr, len, write);
+}
+
 /** 
  * @brief	Kill the currently running thread. If it is the idle thread, the default thread shall be run instead. If it is the last remaining user thread, the scheduler shall restore to the default thread. 
  */
 void sys_thread_kill(){
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
 
+  //Its stack may be handed to a new thread, so the uart irq must stop using its rings
+  io_ring_drop(ksb->running_thread);
+
   //Check if idle thread
   if(ksb->running_thread == ksb->max_threads) {
     //Swap to default idle thread fn
@@ -718,11 +1310,10 @@ void sys_thread_kill(){
     return;
   }
 
-  tcb_buffer[ksb->running_thread].thread_state = INIT;
+  release_exiting_locks(ksb->running_thread);
 
-  int8_t priority = tcb_buffer[ksb->running_thread].priority;
-  ksb->ready_set[priority] = -1;
-  ksb->wait_set[priority]=-1;
+  set_thread_state(ksb->running_thread, INIT);
+  release_queue_remove(ksb->running_thread);
   if(ksb->running_thread != ksb->max_threads) ksb->u_thread_ct--;
   pend_pendsv();
 
@@ -734,10 +1325,15 @@ void sys_thread_kill(){
  */
 void sys_wait_until_next_period(){
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  int int_state = save_interrupt_state_and_disable();
+  adopt_fast_locks(ksb->running_thread);
+  restore_interrupt_state(int_state);
+
   if(!check_no_locks(ksb->running_thread))
     DEBUG_PRINT( "Warning, thread yielding while holding resources.\n" );
 
-  tcb_buffer[ksb->running_thread].thread_state = WAITING;
+  set_thread_state(ksb->running_thread, WAITING);
   pend_pendsv();
   
   return;
@@ -748,100 +1344,541 @@ void sys_wait_until_next_period(){
 
  * @param[in]	max_prio	The maximum priority of this mutex. 0 is the highest priority. Will not be checked for validity until thread attempts to lock the mutex. 
 
- * @return	A pointer to the newly created mutex struct. 
+ * @return	A pointer to the newly created mutex struct. NULL if none are left, or under response time admission if its blocking would make the admitted threads unschedulable.
  */ 
-kmutex_t *sys_mutex_init( uint32_t max_prio ) {
+kmutex_t *sys_mutex_init( uint32_t max_prio, volatile uint32_t *lock_word, mutex_fast_t *fast ) {
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
  
   uint32_t free_mutex;
   if((free_mutex = ksb->u_mutex_ct) >= ksb->max_mutexes)
     return NULL;
+
+  //The kernel writes both from then on, so they must be memory the caller could write itself
+  if(lock_word && !thread_can_access(ksb->running_thread, (const void *)lock_word, sizeof(uint32_t), 1))
+    return NULL;
+  if(fast && !thread_can_access(ksb->running_thread, fast, sizeof(mutex_fast_t), 1))
+    return NULL;
+
+  //A new ceiling can add blocking to threads admitted without it, so the whole set is analysed again
+  if(ksb->sched_policy != SCHED_EDF && ksb->rta_admission && !rta_check(NULL, &max_prio))
+    return NULL;
   
+  //Priority inheritance mutexes have no ceiling for the fast path to check, so their lock word stays taken
+  if(lock_word) *lock_word = (max_prio == MUTEX_INHERIT) ? LOCK_KERNEL : LOCK_FREE;
+  if(max_prio == MUTEX_INHERIT) lock_word = NULL;
+
+  mutex_buffer[free_mutex].locked_by = MUTEX_UNLOCKED;
+  mutex_buffer[free_mutex].lock_word = lock_word;
   mutex_buffer[free_mutex].max_prior = max_prio;
+  mutex_buffer[free_mutex].read_ceil = max_prio;
   mutex_buffer[free_mutex].mutex_num = free_mutex;
+  for(int w = 0; w < PRIO_WORDS; w++)
+    mutex_buffer[free_mutex].waiters[w] = 0;
+  mutex_buffer[free_mutex].reader_ct = 0;
+  for(int w = 0; w < TCB_WORDS; w++)
+    mutex_buffer[free_mutex].readers[w] = 0;
   ksb->u_mutex_ct++;
+
+  if(fast) {
+    fast_state = fast;
+    publish_fast_state(ksb->running_thread);
+  }
   return (kmutex_t *)&(mutex_buffer[free_mutex]);
 }
 
 /**
- * @brief	Lock mutex. Will hang until the mutex has been acquired. 
+ * @brief	Initialize a reader-writer lock. It is a mutex whose ceiling is the highest priority of any user while written, and the highest priority of any writer while read. Threads above every writer can then read while it is read locked, as PCP would let them lock any other mutex of that ceiling.
+
+ * @param[in]	read_prio	The maximum priority of a reader.
+ * @param[in]	write_prio	The maximum priority of a writer.
+
+ * @return	A pointer to the newly created lock, NULL if max_mutexes would be exceeded.
+ */
+kmutex_t *sys_rwlock_init( uint32_t read_prio, uint32_t write_prio ) {
+  kmutex_t *rwlock = sys_mutex_init((read_prio < write_prio) ? read_prio : write_prio, NULL, NULL);
+  if(rwlock == NULL) return NULL;
+
+  rwlock->read_ceil = write_prio;
+  return rwlock;
+}
+
+/**
+ * @brief	Checks whether a mutex can be given to a thread without taking it from another. Readers only exclude writers.
+
+ * @return	1 if it is free for the access, 0 otherwise.
+ */
+static int lock_available(kmutex_t *mutex, int read) {
+  return mutex->locked_by == MUTEX_UNLOCKED && (read || mutex->reader_ct == 0);
+}
+
+/**
+ * @brief	Checks whether a thread holds a reader-writer lock for reading.
+
+ * @return	1 if it does, 0 otherwise.
+ */
+static int lock_reader(kmutex_t *mutex, uint32_t buf_idx) {
+  return (mutex->readers[PRIO_WORD(buf_idx)] & PRIO_BIT(buf_idx)) != 0;
+}
+
+/**
+ * @brief	Gives a free mutex to a thread and raises the system ceiling to match. Under PCP every ceiling level has a single holder, except that readers of a reader-writer lock share its level. The lowest priority holder of a level stands for it, as every other one outranks the threads it blocks.
+
+ * @param[in]	mutex	Mutex to be given.
+ * @param[in]	buf_idx	Tcb_buffer idx of the new holder.
+ * @param[in]	read	Non-zero to give a reader-writer lock for reading.
+ */
+static void grant_mutex(kmutex_t *mutex, uint32_t buf_idx, int read) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  uint32_t ceil = read ? mutex->read_ceil : mutex->max_prior;
+
+  ASSERT(lock_available(mutex, read));
+  tcb_buffer[buf_idx].wait_mutex = NO_MUTEX;
+
+  //Priority inheritance mutexes take no part in the system ceiling
+  if(ceil == MUTEX_INHERIT) {
+    mutex->locked_by = buf_idx;
+    tcb_buffer[buf_idx].locks_held++;
+    return;
+  }
+
+  ASSERT(!ceiling_counts[ceil] || ceiling_holders[ceil] == buf_idx || read || ceiling_readers[ceil]);
+
+  if(read) {
+    mutex->readers[PRIO_WORD(buf_idx)] |= PRIO_BIT(buf_idx);
+    mutex->reader_ct++;
+    ceiling_readers[ceil]++;
+  } else {
+    mutex->locked_by = buf_idx;
+    if(mutex->lock_word) *mutex->lock_word = LOCK_KERNEL | LOCK_OWNER(buf_idx);
+  }
+  tcb_buffer[buf_idx].locks_held++;
+
+  if(!ceiling_counts[ceil] || tcb_buffer[buf_idx].priority > tcb_buffer[ceiling_holders[ceil]].priority)
+    ceiling_holders[ceil] = buf_idx;
+  ceiling_counts[ceil]++;
+  ceiling_bits[PRIO_WORD(ceil)] |= PRIO_BIT(ceil);
+  if(ceil < (uint32_t)ksb->priority_ceiling)
+    ksb->priority_ceiling = ceil;
+}
+
+/**
+ * @brief	Finds the lowest priority holder of a ceiling level by scanning the locked mutexes. Only needed once readers have shared the level.
+
+ * @param[in]	ceil	Ceiling level, with at least one holder.
+
+ * @return	Tcb_buffer idx of the holder.
+ */
+static uint32_t find_level_holder(uint32_t ceil) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  int32_t holder = -1;
+
+  for(uint32_t m = 0; m < ksb->u_mutex_ct; m++) {
+    kmutex_t *mutex = (kmutex_t *)&mutex_buffer[m];
+
+    if(mutex->locked_by != MUTEX_UNLOCKED && mutex->max_prior == ceil) {
+      if(holder < 0 || tcb_buffer[mutex->locked_by].priority > tcb_buffer[holder].priority)
+        holder = mutex->locked_by;
+    }
+
+    if(!mutex->reader_ct || mutex->read_ceil != ceil) continue;
+
+    for(uint32_t w = 0; w < TCB_WORDS; w++) {
+      uint32_t readers = mutex->readers[w];
+
+      while(readers) {
+        uint32_t buf_idx = PRIO_OF(w, readers);
+        readers &= ~PRIO_BIT(buf_idx);
+
+        if(holder < 0 || tcb_buffer[buf_idx].priority > tcb_buffer[holder].priority)
+          holder = buf_idx;
+      }
+    }
+  }
+
+  ASSERT(holder >= 0);
+  return holder;
+}
+
+/**
+ * @brief	Takes a mutex from a thread and lowers the system ceiling once no other locked mutex shares its ceiling. If readers shared the level and the thread stood for it, another holder takes its place.
+
+ * @param[in]	mutex	Mutex to be freed.
+ * @param[in]	buf_idx	Tcb_buffer idx of the holder, the writer or one of the readers.
+ */
+static void release_mutex(kmutex_t *mutex, uint32_t buf_idx) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  int read = mutex->locked_by != buf_idx;
+  uint32_t ceil = read ? mutex->read_ceil : mutex->max_prior;
+
+  if(ceil == MUTEX_INHERIT) {
+    mutex->locked_by = MUTEX_UNLOCKED;
+    tcb_buffer[buf_idx].locks_held--;
+    return;
+  }
+
+  if(read) {
+    mutex->readers[PRIO_WORD(buf_idx)] &= ~PRIO_BIT(buf_idx);
+    mutex->reader_ct--;
+    ceiling_readers[ceil]--;
+  } else {
+    mutex->locked_by = MUTEX_UNLOCKED;
+    if(mutex->lock_word) *mutex->lock_word = LOCK_FREE;
+  }
+  tcb_buffer[buf_idx].locks_held--;
+
+  if(--ceiling_counts[ceil] == 0) {
+    ceiling_bits[PRIO_WORD(ceil)] &= ~PRIO_BIT(ceil);
+    ksb->priority_ceiling = find_highest_locked();
+  } else if(ceiling_holders[ceil] == buf_idx && (read || ceiling_readers[ceil])) {
+    ceiling_holders[ceil] = find_level_holder(ceil);
+  }
+}
+
+/**
+ * @brief	Moves the mutexes a thread locked in user space under kernel tracking, so their ceilings count and later unlocks come through the kernel. Needed before the thread locks through the kernel or leaves the cpu. Scans the mutex pool, but only while the thread holds fast path locks. Must be called with interrupts disabled.
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the thread.
+ */
+static void adopt_fast_locks(uint32_t buf_idx) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  if(fast_state == NULL || !fast_state->held[buf_idx]) return;
+
+  uint32_t adopted = 0;
+  for(uint32_t m = 0; m < ksb->u_mutex_ct; m++) {
+    kmutex_t *mutex = (kmutex_t *)&mutex_buffer[m];
+
+    if(mutex->lock_word && *mutex->lock_word == LOCK_OWNER(buf_idx)) {
+      grant_mutex(mutex, buf_idx, 0);
+      adopted++;
+    }
+  }
+
+  //An exception clears the exclusive monitor, so a thread interrupted mid update retries with this value
+  fast_state->held[buf_idx] -= adopted;
+}
+
+/**
+ * @brief	Tells the fast path which thread is running and whether it may lock in user space. It may while it is a user thread the system ceiling lets lock, or it holds the ceiling. EDF dispatches out of priority order, so there every lock goes through the kernel.
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the running thread.
+ */
+static void publish_fast_state(uint32_t buf_idx) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  if(fast_state == NULL) return;
+
+  uint32_t prio = tcb_buffer[buf_idx].priority;
+  fast_state->running_thread = buf_idx;
+
+  if(buf_idx < ksb->max_threads && ksb->sched_policy != SCHED_EDF && 
+    ((uint32_t)ksb->priority_ceiling > prio || (int32_t)buf_idx == find_highest_locker()))
+    fast_state->fast_prio = prio;
+  else
+    fast_state->fast_prio = FAST_PRIO_NONE;
+}
+
+/**
+ * @brief	Blocks a thread until it is handed the mutex it wants. The thread is queued on that mutex and the holder of the system ceiling inherits its priority. Must be called with interrupts disabled and only while the system ceiling blocks the thread, or the mutex is held.
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the thread to block.
+ * @param[in]	mutex	Mutex the thread wants.
+ * @param[in]	read	Non-zero if it wants a reader-writer lock for reading.
+ */
+static void block_on_mutex(uint32_t buf_idx, kmutex_t *mutex, int read) {
+  uint32_t prio = tcb_buffer[buf_idx].priority;
+
+  tcb_buffer[buf_idx].wait_mutex = mutex->mutex_num;
+  tcb_buffer[buf_idx].wait_read = read;
+  mutex->waiters[PRIO_WORD(prio)] |= PRIO_BIT(prio);
+  mutex_waiter_bits[PRIO_WORD(prio)] |= PRIO_BIT(prio);
+  raise_blocking_priority(prio);
+
+  set_thread_state(buf_idx, BLOCKED);
+}
+
+/**
+ * @brief	Hands mutexes to the threads blocked on them, highest priority first, while the system ceiling allows it. The mutex a thread wants is normally free by then, as any holder would keep the ceiling at or above its priority. Only higher priority readers of a reader-writer lock can still hold it, and its waiter is skipped until they unlock. Granting a mutex raises the ceiling to at least the thread's priority, so usually one waiter is granted per unlock, while readers of a lock freed by its writer may all be granted at once. The first waiter still blocked by the ceiling makes the ceiling holder inherit its priority. Must be called with interrupts disabled.
+ */
+static void wake_mutex_waiter() {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  for(uint32_t w = 0; w < PRIO_WORDS; w++) {
+    uint32_t waiters = mutex_waiter_bits[w];
+
+    while(waiters) {
+      uint32_t prio = PRIO_OF(w, waiters);
+      waiters &= ~PRIO_BIT(prio);
+
+      if((uint32_t)ksb->priority_ceiling <= prio) {
+        raise_blocking_priority(prio);
+        return;
+      }
+
+      uint32_t buf_idx = ksb->blocked_set[prio];
+      kmutex_t *mutex = (kmutex_t *)&mutex_buffer[tcb_buffer[buf_idx].wait_mutex];
+      int read = tcb_buffer[buf_idx].wait_read;
+
+      if(!lock_available(mutex, read)) continue;
+
+      mutex->waiters[w] &= ~PRIO_BIT(prio);
+      mutex_waiter_bits[w] &= ~PRIO_BIT(prio);
+
+      grant_mutex(mutex, buf_idx, read);
+      set_thread_state(buf_idx, RUNNABLE);
+    }
+  }
+}
+
+/**
+ * @brief	Passes an inherited priority down the chain of holders a thread waits behind. Each holder inherits it, and if that holder is itself blocked on a mutex, so does the next one: the holder of a priority inheritance mutex, or of the system ceiling if PCP blocks it. Stops at the first holder that already runs at least as high or is not blocked on a mutex. Must be called with interrupts disabled.
+
+ * @param[in]	holder	Tcb_buffer idx of the first holder.
+ * @param[in]	prio	Priority passed down.
+ */
+static void inherit_along_chain(uint32_t holder, uint32_t prio) {
+  for(uint32_t hops = 0; hops < BUFFER_SIZE; hops++) { //A deadlock cycle must not hang the kernel
+    if(tcb_buffer[holder].inherited_prior <= prio) return;
+    tcb_buffer[holder].inherited_prior = prio;
+
+    uint32_t wait_mutex = tcb_buffer[holder].wait_mutex;
+    if(tcb_buffer[holder].thread_state != BLOCKED || wait_mutex == NO_MUTEX) return;
+
+    kmutex_t *next = (kmutex_t *)&mutex_buffer[wait_mutex];
+    int32_t next_holder = (next->max_prior == MUTEX_INHERIT) ? (int32_t)next->locked_by : find_highest_locker();
+    if(next_holder < 0) return;
+    holder = next_holder;
+  }
+}
+
+/**
+ * @brief	Finds the thread blocked on a priority inheritance mutex with the highest inherited priority, which counts any priority passed down to it. 
+
+ * @param[in]	mutex	Mutex to search.
+
+ * @return	Tcb_buffer idx of the waiter, -1 if there is none.
+ */
+static int32_t top_inherit_waiter(kmutex_t *mutex) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  int32_t top = -1;
+
+  for(uint32_t w = 0; w < PRIO_WORDS; w++) {
+    uint32_t waiters = mutex->waiters[w];
+
+    while(waiters) {
+      uint32_t prio = PRIO_OF(w, waiters);
+      int32_t buf_idx = ksb->blocked_set[prio];
+      waiters &= ~PRIO_BIT(prio);
+
+      if(top < 0 || tcb_buffer[buf_idx].inherited_prior < tcb_buffer[top].inherited_prior)
+        top = buf_idx;
+    }
+  }
+
+  return top;
+}
+
+/**
+ * @brief	Hands a priority inheritance mutex that was just unlocked to its top waiter. The new holder inherits from the waiters left behind. Must be called with interrupts disabled.
+
+ * @param[in]	mutex	Mutex to hand over.
+ */
+static void wake_inherit_waiter(kmutex_t *mutex) {
+  int32_t waiter = top_inherit_waiter(mutex);
+  if(waiter < 0) return;
+
+  uint32_t prio = tcb_buffer[waiter].priority;
+  mutex->waiters[PRIO_WORD(prio)] &= ~PRIO_BIT(prio);
+  grant_mutex(mutex, waiter, 0);
+  set_thread_state(waiter, RUNNABLE);
+
+  int32_t next = top_inherit_waiter(mutex);
+  if(next < 0)
+    inherit_contended--;
+  else if(tcb_buffer[next].inherited_prior < tcb_buffer[waiter].inherited_prior)
+    tcb_buffer[waiter].inherited_prior = tcb_buffer[next].inherited_prior;
+}
+
+/**
+ * @brief	Restores what a thread inherits from the waiters of the priority inheritance mutexes it still holds, after an unlock has reset its inherited priority. Scans the mutex pool, but only while such mutexes are contended. Must be called with interrupts disabled.
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the thread.
+ */
+static void inherit_from_waiters(uint32_t buf_idx) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  if(!inherit_contended) return;
+
+  for(uint32_t m = 0; m < ksb->u_mutex_ct; m++) {
+    kmutex_t *mutex = (kmutex_t *)&mutex_buffer[m];
+    if(mutex->max_prior != MUTEX_INHERIT || mutex->locked_by != buf_idx) continue;
+
+    int32_t waiter = top_inherit_waiter(mutex);
+    if(waiter > -1 && tcb_buffer[waiter].inherited_prior < tcb_buffer[buf_idx].inherited_prior)
+      tcb_buffer[buf_idx].inherited_prior = tcb_buffer[waiter].inherited_prior;
+  }
+}
+
+/**
+ * @brief	Finds the ready holder of a priority inheritance mutex that inherited the highest priority. Scans the mutex pool, but only while such mutexes are contended.
+
+ * @return	Tcb_buffer idx of the holder, -1 if no ready holder runs above its own priority.
+ */
+static int32_t find_inheriting_holder() {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  int32_t best = -1;
+
+  if(!inherit_contended) return -1;
+
+  for(uint32_t m = 0; m < ksb->u_mutex_ct; m++) {
+    if(mutex_buffer[m].max_prior != MUTEX_INHERIT || mutex_buffer[m].locked_by == MUTEX_UNLOCKED) continue;
+
+    int32_t holder = mutex_buffer[m].locked_by;
+    if(!lock_holder_ready(holder) || tcb_buffer[holder].inherited_prior >= tcb_buffer[holder].priority) continue;
+
+    if(best < 0 || tcb_buffer[holder].inherited_prior < tcb_buffer[best].inherited_prior)
+      best = holder;
+  }
+
+  return best;
+}
+
+/**
+ * @brief	Lock a priority inheritance mutex. With no ceiling, a free mutex is always granted. Otherwise the current thread leaves the ready set until the mutex is handed to it on unlock, and its priority passes down the chain of holders it waits behind.
+
+ * @param[in]	mutex	Mutex to be acquired.
+ */
+static void lock_inherit(kmutex_t *mutex) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  uint32_t running_thread = ksb->running_thread;
+
+  int int_state = save_interrupt_state_and_disable(); //Svc handlers can be preempted by systick
+  adopt_fast_locks(running_thread); //It may leave the cpu holding them
+
+  if(mutex->locked_by == running_thread) {
+    restore_interrupt_state(int_state);
+    DEBUG_PRINT( "Warning! Attempted to lock previously locked mutex.\n" );
+    return;
+  }
+
+  if(mutex->locked_by == MUTEX_UNLOCKED) {
+    grant_mutex(mutex, running_thread, 0);
+    restore_interrupt_state(int_state);
+    return;
+  }
+
+  if(running_thread >= ksb->max_threads) {
+    restore_interrupt_state(int_state);
+    DEBUG_PRINT( "Default thread attempting to block on mutex \n" );
+    return; //Only user threads have a blocked set entry
+  }
+
+  if(top_inherit_waiter(mutex) < 0) inherit_contended++;
+
+  //Wait to be handed the mutex. The pended switch happens as soon as interrupts are restored
+  uint32_t prio = tcb_buffer[running_thread].priority;
+  tcb_buffer[running_thread].wait_mutex = mutex->mutex_num;
+  tcb_buffer[running_thread].wait_read = 0;
+  mutex->waiters[PRIO_WORD(prio)] |= PRIO_BIT(prio);
+  set_thread_state(running_thread, BLOCKED);
+  inherit_along_chain(mutex->locked_by, tcb_buffer[running_thread].inherited_prior);
+
+  pend_pendsv();
+  restore_interrupt_state(int_state);
+}
+
+/**
+ * @brief	Lock mutex. If the system ceiling blocks the current thread, or the mutex is a reader-writer lock held against the access, it leaves the ready set until the mutex is handed to it on unlock. 
 
  * @param[in]	mutex	Mutex to be acquired. 
+ * @param[in]	read	Non-zero to lock a reader-writer lock for reading.
  */
-void sys_mutex_lock( kmutex_t *mutex ) {
+static void lock_mutex(kmutex_t *mutex, int read) {
   
   k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  uint32_t running_thread = ksb->running_thread;
 
-  if(ksb->running_thread == ksb->max_threads) 
+  if(running_thread == ksb->max_threads) {
     DEBUG_PRINT( "Idle thread attempting to lock mutex \n" );
     //printk( "Idle thread attempting to lock mutex \n" );
+    return; //Idle thread must never block
+  }
+
+  //No ceiling to check against
+  if(mutex->max_prior == MUTEX_INHERIT) {
+    lock_inherit(mutex);
+    return;
+  }
   
-  uint32_t mutex_num = mutex -> mutex_num;
-  uint32_t curr_ceil = tcb_buffer[ksb->running_thread].priority;
-  if(mutex->max_prior > curr_ceil) {
+  //Writers are held to the write ceiling, which is max_prior for a plain mutex
+  uint32_t curr_ceil = tcb_buffer[running_thread].priority;
+  if((read ? mutex->max_prior : mutex->read_ceil) > curr_ceil) {
     DEBUG_PRINT( "Warning! Thread attempted to lock mutex with insufficient ceiling. Killing thread...\n" );
 
     sys_thread_kill();
+    return; //Killed thread must never be granted or queued on the mutex
+  }
+
+  int int_state = save_interrupt_state_and_disable(); //Svc handlers can be preempted by systick
+
+  //Bring fast path locks under kernel tracking, the caller's own and any other holder of this mutex
+  adopt_fast_locks(running_thread);
+  uint32_t word = mutex->lock_word ? *mutex->lock_word : LOCK_FREE;
+  if(word != LOCK_FREE && !(word & LOCK_KERNEL)) {
+    //User space can write the lock word, so the owner it names is only trusted if it is a live user thread
+    uint32_t owner = word - 1;
+    if(owner >= ksb->max_threads || tcb_buffer[owner].thread_state == INIT) {
+      //Nobody can unlock it, and the kernel does not track it, so it is taken back as free
+      DEBUG_PRINT( "Warning! Mutex lock word names no live thread. Reclaiming it...\n" );
+      if(mutex->locked_by == MUTEX_UNLOCKED) *mutex->lock_word = LOCK_FREE;
+    } else {
+      adopt_fast_locks(owner);
+    }
   }
 
-  //Locked and being locked by same thread
-  if(mutex->locked_by == ksb->running_thread && (mutex_states & (0x1 << mutex_num))) {
+  //Locked and being locked by same thread, either way. A reader cannot upgrade
+  if(mutex->locked_by == running_thread || lock_reader(mutex, running_thread)) {
+    restore_interrupt_state(int_state);
     DEBUG_PRINT( "Warning! Attempted to lock previously locked mutex.\n" );
     return;
   }
 
-  int32_t priority_ceiling = ksb->priority_ceiling; 
-  uint32_t max_prior = mutex->max_prior;
-  //Attempt to lock
-  if((uint32_t)priority_ceiling <= curr_ceil) {
-    //Check if nested
-    if(ksb->running_thread == find_highest_locker()) {
-      mutex_states |= 0x1 << mutex_num;
-      mutex->locked_by = ksb->running_thread;
-      ksb->priority_ceiling = (max_prior < (uint32_t)priority_ceiling) ? (int32_t)mutex->max_prior : priority_ceiling;
-      return;
-    }
-    raise_blocking_priority(curr_ceil);
-  } else {
-    //Lock
-    mutex_states |= 0x1 << mutex_num;
-    mutex->locked_by = ksb->running_thread;
-    ksb->priority_ceiling = (max_prior < (uint32_t)priority_ceiling) ? (int32_t)mutex->max_prior : priority_ceiling;
+  //Lock if above the system ceiling, or if already holding the mutex that sets it (nested). Only higher priority readers can hold it then
+  if(((uint32_t)ksb->priority_ceiling > curr_ceil || (int32_t)running_thread == find_highest_locker()) && lock_available(mutex, read)) {
+    grant_mutex(mutex, running_thread, read);
+    publish_fast_state(running_thread);
+    restore_interrupt_state(int_state);
     return;
   }
 
-  //Wait to acquire
-  while(!acquire_mutex(curr_ceil, mutex->max_prior, mutex_num)) {
-    tcb_buffer[ksb->running_thread].blocked = 1;
-    blocked = 1;
-    pend_pendsv();
-  }
+  //Wait to be handed the mutex. The pended switch happens as soon as interrupts are restored
+  block_on_mutex(running_thread, mutex, read);
+  pend_pendsv();
+  restore_interrupt_state(int_state);
 }
 
 /**
- * @brief	Helper polling function to check if a thread is able to acquire a specific mutex given its current priority.
-
- * @param[in]	curr_ceil	Current static ceiling of acquiring thread.
- * @param[in]	max_prior	Max_prior of the the thread to be acquired.
- * @param[in]	mutex_num	Mutex id of the mutex to be acquired.
+ * @brief	Lock mutex, a reader-writer lock for writing. 
 
- * @return	1 on success. 0 otherwise. 
+ * @param[in]	mutex	Mutex to be acquired. 
  */
-int acquire_mutex(uint32_t curr_ceil, uint32_t max_prior, uint8_t mutex_num) {
-  kmutex_t *mutex = (kmutex_t *)&mutex_buffer[mutex_num];
-  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
-  if((uint32_t)ksb->priority_ceiling > curr_ceil) {
-    mutex_states |= 0x1 << mutex_num;
-    mutex->locked_by = ksb->running_thread;
-    ksb->priority_ceiling = max_prior;
-    return 1;
-  }
+void sys_mutex_lock( kmutex_t *mutex ) {
+  lock_mutex(mutex, 0);
+}
 
-  return 0;
+/**
+ * @brief	Lock a reader-writer lock for reading. 
+
+ * @param[in]	rwlock	Lock to be acquired. 
+ */
+void sys_rwlock_read_lock( kmutex_t *rwlock ) {
+  lock_mutex(rwlock, 1);
 }
 
 /**
  * @brief	Raises blocking thread's inherited priority to match at least current blocked thread's.
+
+ * @param[in]	curr_ceil	Priority of the blocked thread.
  */
 void raise_blocking_priority(uint32_t curr_ceil) {
   int32_t blocking_thread_idx = find_highest_locker();
@@ -852,21 +1889,17 @@ void raise_blocking_priority(uint32_t curr_ceil) {
 }
 
 /**
- * @brief	Find max_prior of locked resource with the highest priority; 
+ * @brief	Find max_prior of locked resource with the highest priority, the most significant bit of the ceiling bitmap. 
 
  * @return	-1 if no locked mutexes found. Else it is max_prior of the locked mutex with the highest max_prior
  */
 int32_t find_highest_locked() {
-  int32_t highest = -1;
-
-  for(int i = 0; i < 32; i++) {
-    if(mutex_states & (0x1 << i)) {
-      if ((uint32_t)highest > mutex_buffer[i].max_prior)
-        highest = mutex_buffer[i].max_prior;
-    }
+  for(uint32_t w = 0; w < CEIL_WORDS; w++) {
+    if(ceiling_bits[w]) 
+      return PRIO_OF(w, ceiling_bits[w]);
   }
 
-  return highest;
+  return -1;
 }
 
 /**
@@ -875,19 +1908,10 @@ int32_t find_highest_locked() {
  * @return	-1 if no locking thread found. Else it is the thread ID of the thread blocking the mutex with the largest max_priority
  */
 int32_t find_highest_locker() {
-  int32_t highest = -1;
-  int32_t highest_ind = -1;
-
-  for(int i = 0; i < 32; i++) {
-    if(mutex_states & (0x1 << i)) {
-      if ((uint32_t)highest > mutex_buffer[i].max_prior) {
-        highest = mutex_buffer[i].max_prior;
-        highest_ind = mutex_buffer[i].locked_by;
-      }
-    }
-  }
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
 
-  return highest_ind;
+  if(ksb->priority_ceiling < 0) return -1;
+  return ceiling_holders[ksb->priority_ceiling];
 }
 
 /**
@@ -898,46 +1922,666 @@ int32_t find_highest_locker() {
  * @return	1 if no locks. 0 if it does hold a lock.
  */
 int check_no_locks(uint32_t thread_buf_idx) {
-
-  for(int i = 0; i < 32; i++) {
-    if(mutex_states & (0x1 << i)) {
-      if(mutex_buffer[i].locked_by == thread_buf_idx)
-        return 0;
-    }
-  }
-  return 1;
+  return tcb_buffer[thread_buf_idx].locks_held == 0;
 }
 
 /**
- * @brief	Unlock specific mutex. Will hang until it has been sucessfully unlocked.
+ * @brief	Unlock specific mutex, or a reader-writer lock held either way. Ownership passes directly to the highest priority blocked threads that the new system ceiling allows.
  
  * @param[in]	mutex	Mutex to be unlocked. 
  */ 
 void sys_mutex_unlock( kmutex_t *mutex ) {
-  uint32_t mutex_num = mutex->mutex_num;
-  uint32_t locked_by = mutex->locked_by;
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  int int_state = save_interrupt_state_and_disable();
+  adopt_fast_locks(ksb->running_thread); //The fast path only sends kernel tracked mutexes here, unless misused
+  restore_interrupt_state(int_state);
+
+  uint32_t locked_by = ksb->running_thread;
+  int reader = lock_reader(mutex, locked_by);
 
   //Unlocked and being 
-  if(!(mutex_states & (0x1 << mutex_num))) {
+  if(mutex->locked_by == MUTEX_UNLOCKED && !reader) {
     DEBUG_PRINT( "Warning! Attempted to unlock previously unlocked mutex.\n");
     return;
   }
   
-  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
-  
-  //Check unlock by another mutex
-  if(ksb->running_thread != mutex->locked_by) {
-    blocked = 1;
-    pend_pendsv();
+  //Check unlock by another thread
+  if(mutex->locked_by != locked_by && !reader) {
+    DEBUG_PRINT( "Warning! Attempted to unlock mutex held by another thread.\n");
+    return;
   }
 
-  //Unlock
-  mutex_states &= ~(0x1 << mutex_num);
+  int_state = save_interrupt_state_and_disable();
 
-  //Update priority ceiling and inherited priority
-  ksb->priority_ceiling = find_highest_locked();
+  //Unlock and update priority ceiling and inherited priority
+  release_mutex(mutex, locked_by);
 
   tcb_buffer[locked_by].inherited_prior = tcb_buffer[locked_by].priority;
+
+  if(mutex->max_prior == MUTEX_INHERIT) wake_inherit_waiter(mutex);
+  inherit_from_waiters(locked_by);
+  wake_mutex_waiter();
+
+  pend_pendsv();
+  restore_interrupt_state(int_state);
+}
+
+/**
+ * @brief	Unlocks every mutex an exiting thread still holds, fast path locks included, so its waiters are handed them rather than waiting forever. Must be called while the thread is still the running thread.
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the thread.
+ */
+static void release_exiting_locks(uint32_t buf_idx) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  int int_state = save_interrupt_state_and_disable();
+  adopt_fast_locks(buf_idx);
+  if(fast_state != NULL) fast_state->held[buf_idx] = 0; //The slot may go to a new thread
+  restore_interrupt_state(int_state);
+
+  if(check_no_locks(buf_idx)) return;
+  DEBUG_PRINT( "Warning, thread exiting while holding resources. Releasing them.\n" );
+
+  for(uint32_t m = 0; m < ksb->u_mutex_ct; m++) {
+    kmutex_t *mutex = (kmutex_t *)&mutex_buffer[m];
+    if(mutex->locked_by == buf_idx || lock_reader(mutex, buf_idx)) sys_mutex_unlock(mutex);
+  }
+}
+
+/**
+ * @brief	Gets a user thread ready to leave the cpu until a semaphore or event group wakes it. Its fast path locks come under kernel tracking, so their ceilings hold while it is blocked. Held locks stay held, as when yielding. Must be called with interrupts enabled, so a wakeup may arrive before the thread blocks and callers need to check their condition again.
+
+ * @param[in]	buf_idx	Tcb_buffer idx of the thread.
+ */
+static void prepare_to_block(uint32_t buf_idx) {
+  int int_state = save_interrupt_state_and_disable();
+  adopt_fast_locks(buf_idx);
+  restore_interrupt_state(int_state);
+
+  if(!check_no_locks(buf_idx))
+    DEBUG_PRINT( "Warning, thread blocking while holding resources.\n" );
+}
+
+/**
+ * @brief	Blocks the running thread on a wait queue until wait_queue_wake. The condition is checked again with interrupts disabled right before blocking, so a wake between the caller's check and the block is never lost.
+
+ * @param[in]	wq	The wait queue.
+ * @param[in]	done	Returns nonzero once the thread need not wait. Called with interrupts disabled.
+
+ * @return	0 once woken or if done, -1 if the running thread is the idle or default thread.
+ */
+int wait_queue_block(kwait_t *wq, int (*done)(void)) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  uint32_t running_thread = ksb->running_thread;
+
+  if(running_thread >= ksb->max_threads) return -1; //Only user threads have a blocked set entry
+
+  prepare_to_block(running_thread);
+  int int_state = save_interrupt_state_and_disable();
+
+  if(done()) {
+    restore_interrupt_state(int_state);
+    return 0;
+  }
+
+  //The pended switch happens as soon as interrupts are restored
+  uint32_t prio = tcb_buffer[running_thread].priority;
+  wq->waiters[PRIO_WORD(prio)] |= PRIO_BIT(prio);
+  set_thread_state(running_thread, BLOCKED);
+
+  pend_pendsv();
+  restore_interrupt_state(int_state);
+  return 0;
+}
+
+/**
+ * @brief	Wakes every thread blocked on a wait queue. Only pends a PendSV, so interrupt handlers may wake as well as threads.
+
+ * @param[in]	wq	The wait queue.
+ */
+void wait_queue_wake(kwait_t *wq) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  int int_state = save_interrupt_state_and_disable();
+
+  for(uint32_t w = 0; w < PRIO_WORDS; w++) {
+    uint32_t waiters = wq->waiters[w];
+    if(!waiters) continue;
+    wq->waiters[w] = 0;
+
+    while(waiters) {
+      uint32_t prio = PRIO_OF(w, waiters);
+      waiters &= ~PRIO_BIT(prio);
+      set_thread_state(ksb->blocked_set[prio], RUNNABLE);
+    }
+    pend_pendsv();
+  }
+
+  restore_interrupt_state(int_state);
+}
+
+/**
+ * @brief	Initialize a semaphore.
+
+ * @param[in]	count	Initial count of the semaphore.
+
+ * @return	A pointer to the newly created semaphore struct, NULL if none are left.
+ */
+ksem_t *sys_sem_init( uint32_t count ) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  uint32_t free_sem;
+  if((free_sem = ksb->u_sem_ct) >= MAX_SEMAPHORES)
+    return NULL;
+
+  sem_buffer[free_sem].count = count;
+  for(int w = 0; w < PRIO_WORDS; w++)
+    sem_buffer[free_sem].waiters[w] = 0;
+  ksb->u_sem_ct++;
+
+  return (ksem_t *)&(sem_buffer[free_sem]);
+}
+
+/**
+ * @brief	Take a semaphore. If the count is 0, the current thread leaves the ready set until a give hands it the count, so it uses no cpu time while it waits. Its budget and period carry on as if it had yielded. 
+
+ * @param[in]	sem	Semaphore to be taken.
+
+ * @return	0 once taken. -1 if the idle or default thread would have to block.
+ */
+int sys_sem_take( ksem_t *sem ) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  uint32_t running_thread = ksb->running_thread;
+
+  int int_state = save_interrupt_state_and_disable(); //Gives may come from interrupt handlers
+
+  if(sem->count > 0) {
+    sem->count--;
+    restore_interrupt_state(int_state);
+    return 0;
+  }
+
+  if(running_thread >= ksb->max_threads) {
+    restore_interrupt_state(int_state);
+    DEBUG_PRINT( "Idle or default thread attempting to block on semaphore \n" );
+    return -1; //Only user threads have a blocked set entry
+  }
+
+  restore_interrupt_state(int_state);
+  prepare_to_block(running_thread);
+  int_state = save_interrupt_state_and_disable();
+
+  //A give may have come in while interrupts were on
+  if(sem->count > 0) {
+    sem->count--;
+    restore_interrupt_state(int_state);
+    return 0;
+  }
+
+  //Wait to be handed the count. The pended switch happens as soon as interrupts are restored
+  uint32_t prio = tcb_buffer[running_thread].priority;
+  sem->waiters[PRIO_WORD(prio)] |= PRIO_BIT(prio);
+  set_thread_state(running_thread, BLOCKED);
+
   pend_pendsv();
+  restore_interrupt_state(int_state);
+  return 0;
+}
+
+/**
+ * @brief	Give a semaphore. The count passes directly to the highest priority thread blocked on it, otherwise the count is incremented. Only pends a PendSV, so interrupt handlers may give as well as threads.
+
+ * @param[in]	sem	Semaphore to be given.
+ */
+void sys_sem_give( ksem_t *sem ) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  int int_state = save_interrupt_state_and_disable();
+
+  for(uint32_t w = 0; w < PRIO_WORDS; w++) {
+    if(!sem->waiters[w]) continue;
+
+    uint32_t prio = PRIO_OF(w, sem->waiters[w]);
+    sem->waiters[w] &= ~PRIO_BIT(prio);
+    set_thread_state(ksb->blocked_set[prio], RUNNABLE);
+
+    pend_pendsv();
+    restore_interrupt_state(int_state);
+    return;
+  }
+
+  sem->count++;
+  restore_interrupt_state(int_state);
+}
+
+/**
+ * @brief	Initialize an event group with every flag clear.
+
+ * @return	A pointer to the newly created event group struct, NULL if none are left.
+ */
+kevent_t *sys_event_init( void ) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  uint32_t free_event;
+  if((free_event = ksb->u_event_ct) >= MAX_EVENT_GROUPS)
+    return NULL;
+
+  event_buffer[free_event].flags = 0;
+  for(int w = 0; w < PRIO_WORDS; w++)
+    event_buffer[free_event].waiters[w] = 0;
+  ksb->u_event_ct++;
+
+  return (kevent_t *)&(event_buffer[free_event]);
+}
+
+/**
+ * @brief	Checks a flag word against the mask of an event group wait.
+
+ * @return	Non-zero if the wait is satisfied.
+ */
+static int event_satisfied(uint32_t flags, uint32_t mask, uint32_t options) {
+  if(options & EVENT_WAIT_ALL) return (flags & mask) == mask;
+  return (flags & mask) != 0;
+}
+
+/**
+ * @brief	Set flags of an event group. Every blocked thread whose wait the new flags satisfy is made runnable, and all of them see the flags before any are cleared on their behalf. Only pends a PendSV, so interrupt handlers may set flags as well as threads.
+
+ * @param[in]	event	Event group to act on.
+ * @param[in]	flags	Flags to set.
+
+ * @return	The flags left set.
+ */
+uint32_t sys_event_set( kevent_t *event, uint32_t flags ) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  int int_state = save_interrupt_state_and_disable();
+
+  flags |= event->flags;
+  uint32_t clear = 0;
+  int woken = 0;
+
+  for(uint32_t w = 0; w < PRIO_WORDS; w++) {
+    uint32_t waiters = event->waiters[w];
+
+    while(waiters) {
+      uint32_t prio = PRIO_OF(w, waiters);
+      uint32_t buf_idx = ksb->blocked_set[prio];
+      waiters &= ~PRIO_BIT(prio);
+
+      if(!event_satisfied(flags, tcb_buffer[buf_idx].event_mask, tcb_buffer[buf_idx].event_options)) continue;
+
+      if(tcb_buffer[buf_idx].event_options & EVENT_CLEAR) clear |= tcb_buffer[buf_idx].event_mask;
+      tcb_buffer[buf_idx].event_mask = flags; //Handed back by sys_event_wait
+      event->waiters[w] &= ~PRIO_BIT(prio);
+      set_thread_state(buf_idx, RUNNABLE);
+      woken = 1;
+    }
+  }
+
+  event->flags = flags & ~clear;
+  if(woken) pend_pendsv();
+
+  restore_interrupt_state(int_state);
+  return flags & ~clear;
+}
+
+/**
+ * @brief	Clear flags of an event group.
+
+ * @param[in]	event	Event group to act on.
+ * @param[in]	flags	Flags to clear.
+
+ * @return	The flags before clearing.
+ */
+uint32_t sys_event_clear( kevent_t *event, uint32_t flags ) {
+  int int_state = save_interrupt_state_and_disable();
+
+  uint32_t old_flags = event->flags;
+  event->flags = old_flags & ~flags;
+
+  restore_interrupt_state(int_state);
+  return old_flags;
+}
+
+/**
+ * @brief	Wait for any or all flags of a mask in an event group. If the flags do not satisfy the wait yet, the current thread leaves the ready set until a set does, so it uses no cpu time while it waits. Its budget and period carry on as if it had yielded.
+
+ * @param[in]	event	Event group to act on.
+ * @param[in]	mask	Flags to wait for.
+ * @param[in]	options	EVENT_WAIT_ANY or EVENT_WAIT_ALL, optionally OR'd with EVENT_CLEAR.
+
+ * @return	The flags that satisfied the wait, before clearing. 0 if the mask is empty or the idle or default thread would have to block.
+ */
+uint32_t sys_event_wait( kevent_t *event, uint32_t mask, uint32_t options ) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  uint32_t running_thread = ksb->running_thread;
+
+  if(!mask) return 0;
+
+  int int_state = save_interrupt_state_and_disable(); //Sets may come from interrupt handlers
+  uint32_t flags = event->flags;
+
+  if(!event_satisfied(flags, mask, options)) {
+    if(running_thread >= ksb->max_threads) {
+      restore_interrupt_state(int_state);
+      DEBUG_PRINT( "Idle or default thread attempting to block on event group \n" );
+      return 0; //Only user threads have a blocked set entry
+    }
+
+    restore_interrupt_state(int_state);
+    prepare_to_block(running_thread);
+    int_state = save_interrupt_state_and_disable();
+    flags = event->flags;
+  }
+
+  //A set may have come in while interrupts were on
+  if(event_satisfied(flags, mask, options)) {
+    if(options & EVENT_CLEAR) event->flags = flags & ~mask;
+    restore_interrupt_state(int_state);
+    return flags;
+  }
+
+  //Wait for a set to satisfy the mask. The pended switch happens as soon as interrupts are restored
+  uint32_t prio = tcb_buffer[running_thread].priority;
+  tcb_buffer[running_thread].event_mask = mask;
+  tcb_buffer[running_thread].event_options = options;
+  event->waiters[PRIO_WORD(prio)] |= PRIO_BIT(prio);
+  set_thread_state(running_thread, BLOCKED);
+
+  pend_pendsv();
+  restore_interrupt_state(int_state);
+
+  //Runs again once a set has woken the thread
+  return tcb_buffer[running_thread].event_mask;
+}
+
+/**
+ * @brief	Initialize a message queue over a pool of slots. Every slot starts out free.
+
+ * @param[in]	slots	Slot pool of slot_ct * slot_size bytes.
+ * @param[in]	slot_size	Size of a message in bytes.
+ * @param[in]	slot_ct	Number of slots in the pool.
+
+ * @return	A pointer to the newly created queue struct, NULL if the pool is invalid or none are left.
+ */
+kqueue_t *sys_queue_init( void *slots, uint32_t slot_size, uint32_t slot_ct ) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  if(slots == NULL || slot_size == 0 || slot_ct == 0 || slot_ct > MAX_QUEUE_SLOTS)
+    return NULL;
+
+  //The kernel copies in and out of the pool, so it must be memory the caller could write itself
+  if(slot_size > UINT32_MAX / slot_ct || !thread_can_access(ksb->running_thread, slots, slot_size * slot_ct, 1))
+    return NULL;
+
+  uint32_t free_queue;
+  if((free_queue = ksb->u_queue_ct) >= MAX_QUEUES)
+    return NULL;
+
+  kqueue_t *queue = (kqueue_t *)&queue_buffer[free_queue];
+  queue->slots = slots;
+  queue->slot_size = slot_size;
+  queue->slot_ct = slot_ct;
+  for(uint32_t i = 0; i < slot_ct; i++) {
+    queue->free_slots[i] = i;
+    queue->slot_held[i] = SLOT_FREE;
+  }
+  queue->free_ct = slot_ct;
+  queue->full_head = 0;
+  queue->full_ct = 0;
+  for(int w = 0; w < PRIO_WORDS; w++) {
+    queue->send_waiters[w] = 0;
+    queue->recv_waiters[w] = 0;
+  }
+  ksb->u_queue_ct++;
+
+  return queue;
+}
+
+/**
+ * @brief	Takes a slot off the free stack or the sent FIFO for the current thread. If the list is empty, the thread leaves the ready set until a slot is handed to it, so it uses no cpu time while it waits.
+
+ * @param[in]	queue	Queue to act on.
+ * @param[in]	sent	Non-zero to take a sent slot, 0 to take a free one.
+
+ * @return	Index of the slot, -1 if the idle or default thread would have to block.
+ */
+static int32_t queue_take_slot(kqueue_t *queue, int sent) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  uint32_t running_thread = ksb->running_thread;
+  volatile uint32_t *waiters = sent ? queue->recv_waiters : queue->send_waiters;
+  uint32_t slot;
+
+  int int_state = save_interrupt_state_and_disable(); //Svc handlers can be preempted by systick
+
+  for(int tries = 0; tries < 2; tries++) {
+    if(sent && queue->full_ct > 0) {
+      slot = queue->full_slots[queue->full_head];
+      queue->full_head = (queue->full_head + 1) % queue->slot_ct;
+      queue->full_ct--;
+      queue->slot_held[slot] = running_thread;
+      restore_interrupt_state(int_state);
+      return slot;
+    }
+
+    if(!sent && queue->free_ct > 0) {
+      slot = queue->free_slots[--queue->free_ct];
+      queue->slot_held[slot] = running_thread;
+      restore_interrupt_state(int_state);
+      return slot;
+    }
+
+    if(tries) break;
+
+    if(running_thread >= ksb->max_threads) {
+      restore_interrupt_state(int_state);
+      DEBUG_PRINT( "Idle or default thread attempting to block on message queue \n" );
+      return -1; //Only user threads have a blocked set entry
+    }
+
+    //A slot may come in while interrupts are on, so the lists are checked again
+    restore_interrupt_state(int_state);
+    prepare_to_block(running_thread);
+    int_state = save_interrupt_state_and_disable();
+  }
+
+  //Wait to be handed a slot. The pended switch happens as soon as interrupts are restored
+  uint32_t prio = tcb_buffer[running_thread].priority;
+  waiters[PRIO_WORD(prio)] |= PRIO_BIT(prio);
+  set_thread_state(running_thread, BLOCKED);
+
+  pend_pendsv();
+  restore_interrupt_state(int_state);
+
+  //Runs again once the slot has been handed over
+  return tcb_buffer[running_thread].queue_slot;
+}
+
+/**
+ * @brief	Puts a slot a thread holds onto the sent FIFO or the free stack. If a thread is blocked waiting for such a slot, the highest priority one is handed it directly instead.
+
+ * @param[in]	queue	Queue to act on.
+ * @param[in]	slot	Index of the slot.
+ * @param[in]	sent	Non-zero to send the slot, 0 to free it.
+
+ * @return	0 on success, -1 if the current thread does not hold the slot.
+ */
+static int queue_put_slot(kqueue_t *queue, uint32_t slot, int sent) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+  volatile uint32_t *waiters = sent ? queue->recv_waiters : queue->send_waiters;
+
+  int int_state = save_interrupt_state_and_disable();
+
+  //The holder may still be filling or reading the slot in place
+  if(queue->slot_held[slot] != ksb->running_thread) {
+    restore_interrupt_state(int_state);
+    DEBUG_PRINT( "Warning! Attempted to pass on a message queue slot the thread does not hold.\n" );
+    return -1;
+  }
+
+  for(uint32_t w = 0; w < PRIO_WORDS; w++) {
+    if(!waiters[w]) continue;
+
+    uint32_t prio = PRIO_OF(w, waiters[w]);
+    uint32_t buf_idx = ksb->blocked_set[prio];
+    waiters[w] &= ~PRIO_BIT(prio);
+
+    tcb_buffer[buf_idx].queue_slot = slot;
+    queue->slot_held[slot] = buf_idx; //Still held, by the woken thread now
+    set_thread_state(buf_idx, RUNNABLE);
+
+    pend_pendsv();
+    restore_interrupt_state(int_state);
+    return 0;
+  }
+
+  queue->slot_held[slot] = SLOT_FREE;
+  if(sent)
+    queue->full_slots[(queue->full_head + queue->full_ct++) % queue->slot_ct] = slot;
+  else
+    queue->free_slots[queue->free_ct++] = slot;
+
+  restore_interrupt_state(int_state);
+  return 0;
+}
+
+/**
+ * @brief	Checks that a handle passed in from user space is a queue the kernel handed out.
+
+ * @return	Non-zero if the queue is valid.
+ */
+static int queue_valid(kqueue_t *queue) {
+  k_threading_state_t *ksb = (k_threading_state_t *)kernel_threading_state;
+
+  for(uint32_t i = 0; i < ksb->u_queue_ct; i++) {
+    if(queue == (kqueue_t *)&queue_buffer[i]) return 1;
+  }
+  DEBUG_PRINT( "Warning! Invalid message queue handle.\n" );
+  return 0;
+}
+
+/**
+ * @brief	Finds the index of a slot from its address.
+
+ * @return	Index of the slot, -1 if the address is not the start of a slot of the queue.
+ */
+static int32_t queue_slot_index(kqueue_t *queue, void *slot) {
+  uint32_t offset = (char *)slot - queue->slots;
+
+  if((char *)slot < queue->slots || offset % queue->slot_size || offset / queue->slot_size >= queue->slot_ct)
+    return -1;
+
+  return offset / queue->slot_size;
+}
+
+/**
+ * @brief	Copies a message between a user buffer and a slot.
+ */
+static void queue_copy(char *dst, const char *src, uint32_t size) {
+  while(size--)
+    *dst++ = *src++;
+}
+
+/**
+ * @brief	Take a free slot to fill in place.
+
+ * @param[in]	queue	Queue to act on.
+
+ * @return	The slot, NULL if the idle or default thread would have to block.
+ */
+void *sys_queue_alloc( kqueue_t *queue ) {
+  if(!queue_valid(queue)) return NULL;
+
+  int32_t slot = queue_take_slot(queue, 0);
+  if(slot < 0) return NULL;
+
+  return queue->slots + slot * queue->slot_size;
+}
+
+/**
+ * @brief	Send a slot without copying it.
+
+ * @param[in]	queue	Queue to act on.
+ * @param[in]	slot	Slot taken with sys_queue_alloc.
+
+ * @return	0 on success, -1 if the queue or slot is invalid or the caller does not hold the slot.
+ */
+int sys_queue_send_slot( kqueue_t *queue, void *slot ) {
+  if(!queue_valid(queue)) return -1;
+
+  int32_t idx = queue_slot_index(queue, slot);
+  if(idx < 0) return -1;
+
+  return queue_put_slot(queue, idx, 1);
+}
+
+/**
+ * @brief	Take the oldest sent slot to read in place.
+
+ * @param[in]	queue	Queue to act on.
+
+ * @return	The slot, NULL if the idle or default thread would have to block.
+ */
+void *sys_queue_recv_slot( kqueue_t *queue ) {
+  if(!queue_valid(queue)) return NULL;
+
+  int32_t slot = queue_take_slot(queue, 1);
+  if(slot < 0) return NULL;
+
+  return queue->slots + slot * queue->slot_size;
+}
+
+/**
+ * @brief	Give back a received slot so it can be sent again.
+
+ * @param[in]	queue	Queue to act on.
+ * @param[in]	slot	Slot taken with sys_queue_recv_slot.
+
+ * @return	0 on success, -1 if the queue or slot is invalid or the caller does not hold the slot.
+ */
+int sys_queue_release( kqueue_t *queue, void *slot ) {
+  if(!queue_valid(queue)) return -1;
+
+  int32_t idx = queue_slot_index(queue, slot);
+  if(idx < 0) return -1;
+
+  return queue_put_slot(queue, idx, 0);
+}
+
+/**
+ * @brief	Copy a message into the queue. Built from the zero copy calls, with the copy in between.
+
+ * @param[in]	queue	Queue to act on.
+ * @param[in]	msg	Message of slot_size bytes.
+
+ * @return	0 on success, -1 if the queue or message is invalid or the idle or default thread would have to block.
+ */
+int sys_queue_send( kqueue_t *queue, const void *msg ) {
+  if(!queue_valid(queue) || !thread_can_access(get_running_thread(), msg, queue->slot_size, 0)) return -1;
+
+  char *slot = sys_queue_alloc(queue);
+  if(slot == NULL) return -1;
+
+  queue_copy(slot, msg, queue->slot_size);
+  return sys_queue_send_slot(queue, slot);
+}
+
+/**
+ * @brief	Copy the oldest message out of the queue.
+
+ * @param[in]	queue	Queue to act on.
+ * @param[out]	msg	Buffer of slot_size bytes.
+
+ * @return	0 on success, -1 if the queue or buffer is invalid or the idle or default thread would have to block.
+ */
+int sys_queue_recv( kqueue_t *queue, void *msg ) {
+  if(!queue_valid(queue) || !thread_can_access(get_running_thread(), msg, queue->slot_size, 1)) return -1;
+
+  char *slot = sys_queue_recv_slot(queue);
+  if(slot == NULL) return -1;
 
+  queue_copy(msg, slot, queue->slot_size);
+  return sys_queue_release(queue, slot);
 }
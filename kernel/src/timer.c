@@ -29,6 +29,31 @@ typedef struct {
   volatile uint32_t stk_calib;
 } sys_tick_reg_map;
 
+/** @brief Interrupt control and state register, used to check for a pending systick */
+#define ICSR ((volatile uint32_t *) 0xE000ED04)
+/** @brief Systick exception pending bit */
+#define ICSR_PENDSTSET (1 << 26)
+
+/** @brief Reload value programmed by timer_start, one tick is this plus one cycles */
+static uint32_t tick_load = 0;
+
+/** @brief Number of ticks covered by the current stretched countdown, 0 if not stretched */
+static uint32_t stretch_ticks = 0;
+
+/**
+*  @brief	Starts a single countdown of the given length, after which the counter goes back to reloading with tick_load. The counter reloads on the clock after stk_val is cleared, so tick_load can be restored as soon as the new count is visible.
+
+*  @param	cycles	Length of the countdown. Must be at least 2 and at most MAX_RELOAD+1.
+*/
+static void timer_reload(uint32_t cycles) {
+  sys_tick_reg_map *reg_map = (sys_tick_reg_map *)SYS_TICK_BASE;
+
+  reg_map->stk_load = cycles - 1;
+  reg_map->stk_val = 0;
+  while(reg_map->stk_val == 0);
+  reg_map->stk_load = tick_load;
+}
+
 /**
 *  @brief	Initialize systick timer to utilize the cpu clock and fire with specified precomputed frequency. 
 
@@ -42,6 +67,8 @@ int timer_start(int frequency){
   
   /* Set reload value as specified by specific frequency */ 
   reg_map->stk_load |= frequency;
+  tick_load = reg_map->stk_load;
+  stretch_ticks = 0;
 
   /* Enable SysTick counter & interrupt */
   reg_map->stk_ctrl |= PROC_CLK;
@@ -67,3 +94,58 @@ void timer_stop(){
 }
 
 
+
+/**
+*  @brief	Delays the next systick interrupt so that it fires ticks tick boundaries from now instead of on the next one. The phase of the tick is kept. Has no effect if a systick interrupt is already pending. 
+
+*  @param	ticks	Number of tick boundaries to skip to. Clamped to what fits in the reload register.
+
+*  @return	Number of ticks covered by the stretch, 0 if the timer was not stretched. 
+*/
+uint32_t timer_stretch(uint32_t ticks) {
+  sys_tick_reg_map *reg_map = (sys_tick_reg_map *)SYS_TICK_BASE;
+  uint32_t tick_cycles = tick_load + 1;
+
+  if(stretch_ticks || (*ICSR & ICSR_PENDSTSET)) return 0;
+
+  uint32_t remaining = reg_map->stk_val + 1; //Cycles left in the current tick
+  uint32_t max_ticks = (MAX_RELOAD + 1 - remaining)/tick_cycles + 1;
+  if(ticks > max_ticks) ticks = max_ticks;
+  if(ticks < 2) return 0;
+
+  (void)reg_map->stk_ctrl; //Clear countflag
+  stretch_ticks = ticks;
+  timer_reload((ticks-1)*tick_cycles + remaining);
+
+  return ticks;
+}
+
+/**
+*  @brief	Ends a stretch started by timer_stretch. If the stretched countdown already ran out the counter is ticking normally again. Otherwise the counter is reprogrammed to fire on the next tick boundary. 
+
+*  @return	Number of tick boundaries passed during the stretch that no systick interrupt will account for. The interrupt that ends a stretch still counts its own tick. 
+*/
+uint32_t timer_unstretch() {
+  sys_tick_reg_map *reg_map = (sys_tick_reg_map *)SYS_TICK_BASE;
+  uint32_t tick_cycles = tick_load + 1;
+  uint32_t ticks = stretch_ticks;
+
+  if(!ticks) return 0;
+  stretch_ticks = 0;
+
+  uint32_t remaining = reg_map->stk_val + 1;
+  if(reg_map->stk_ctrl & COUNTFLAG) //Countdown ran out, its systick interrupt is running or pending
+    return ticks - 1;
+
+  //Countdown still running, cut it short at the next tick boundary
+  uint32_t boundaries_left = (remaining + tick_cycles - 1)/tick_cycles;
+  uint32_t next_boundary = remaining - (boundaries_left-1)*tick_cycles;
+
+  if(next_boundary < 2) { //Too close to catch, count it as passed
+    timer_reload(next_boundary + tick_cycles);
+    return ticks - boundaries_left + 1;
+  }
+
+  timer_reload(next_boundary);
+  return ticks - boundaries_left;
+}
@@ -16,6 +16,8 @@
 #include <kernel_buffer.h>
 #include <nvic.h>
 #include <debug.h>
+#include <syscall.h>
+#include <arm.h>
 
 /**
 * UART irq number.
@@ -23,7 +25,7 @@
 #define UART_IRQ 38
 
 /**
-* Transmit and receive buffer max sizes. 
+* Transmit and receive buffer max sizes. A power of two. 
 */
 #define BUFFER_SIZE 512
 
@@ -32,6 +34,11 @@
 */
 #define THRESHOLD 16
 
+/**
+* Longest line canonical mode assembles. Further bytes are dropped until the line ends. 
+*/
+#define LINE_BUFFER_SIZE 128
+
 
 /* Map portion of data section to kernel data structures */
 static volatile char recv_buffer[RBUF_SIZE];
@@ -39,6 +46,12 @@ static volatile char transmit_buffer[RBUF_SIZE];
 static volatile char recv_buffer_payload[BUFFER_SIZE]= {0};
 static volatile char transmit_buffer_payload[BUFFER_SIZE] = {0};
 
+/* Canonical mode line discipline state */
+static volatile char line_buffer[LINE_BUFFER_SIZE];
+static volatile uint32_t line_len = 0;
+static volatile uint32_t rx_lines = 0;
+static volatile int rx_raw = 0;
+
 /**
 * @brief	Initialize interrupt-based UART. 
 
@@ -89,7 +102,35 @@ int uart_put_byte(char c){
 }
 
 /**
-* @brief	Attempts to get a single byte from the UART receive buffer. 
+* @brief	Put as many bytes of a span into the UART transmit buffer as fit. 
+
+* @param	ptr	The bytes to be transmitted. 
+* @param	len	Number of bytes. 
+
+* @return	Number of bytes taken, less than len if the buffer filled. 
+*/
+int uart_put_bytes(const char *ptr, int len){
+   struct uart_reg_map *uart = UART2_BASE;
+
+   rbuf_t *ring_buffer = (rbuf_t *)transmit_buffer;
+   int taken = put_n(ring_buffer, ptr, len); 
+   uart->CR1 |= UART_TXE;
+
+   return taken;
+}
+
+/**
+* @brief	Returns the free space in the UART transmit buffer. 
+
+* @return	Number of bytes uart_put_byte can take without failing. 
+*/
+int uart_tx_space(){
+   rbuf_t *ring_buffer = (rbuf_t *)transmit_buffer;
+   return rbuf_space(ring_buffer);
+}
+
+/**
+* @brief	Attempts to get a single byte from the UART receive buffer. In canonical mode only completed lines are in the buffer, each ended by a newline or EOT. 
 
 * @param[out]	c	The pointer meant for the char returned from a poll of the receive buffer. 
 
@@ -102,10 +143,97 @@ int uart_get_byte(char *c){
    if(err) {
       return -1;
    }
+   if(!rx_raw && (polled_byte == '\n' || polled_byte == EOT) && rx_lines) rx_lines--;
    *c = polled_byte;
    return 0;
 }
 
+/**
+* @brief	Takes up to len bytes from the UART receive buffer in one copy. Raw mode only, as canonical reads must stop at the end of a line. 
+
+* @param[out]	ptr	Where the bytes are copied to. 
+* @param	len	Most bytes to take. 
+
+* @return	Number of bytes taken. 
+*/
+int uart_get_bytes(char *ptr, int len){
+   return get_n((rbuf_t *)recv_buffer, ptr, len);
+}
+
+/**
+* @brief	Checks whether a read can go ahead without waiting. 
+
+* @param	want	Bytes the reader asks for.
+
+* @return	Nonzero if a canonical line is complete, or in raw mode if want bytes are in the receive buffer, or as many as it holds. 
+*/
+int uart_rx_ready(int want){
+   rbuf_t *ring_buffer = (rbuf_t *)recv_buffer;
+
+   if(!rx_raw) return rx_lines > 0;
+   if(want > (int)ring_buffer->size) want = ring_buffer->size;
+   return (int)rbuf_count(ring_buffer) >= want;
+}
+
+/**
+* @brief	Selects raw or canonical input. Raw mode hands every byte to readers as it arrives, without echo or line editing, for binary protocols. Canonical mode assembles and echoes lines in the irq and only hands over completed ones. Input not yet read is discarded. 
+
+* @param	raw	1 for raw mode, 0 for canonical mode.
+*/
+void uart_set_raw(int raw){
+   int state = save_interrupt_state_and_disable();
+   kernel_buffer_init((rbuf_t *)recv_buffer, BUFFER_SIZE, recv_buffer_payload);
+   line_len = 0;
+   rx_lines = 0;
+   rx_raw = raw;
+   restore_interrupt_state(state);
+}
+
+/**
+* @brief	Returns the input mode. 
+
+* @return	1 in raw mode, 0 in canonical mode.
+*/
+int uart_get_raw(){
+   return rx_raw;
+}
+
+/**
+* @brief	Canonical mode line discipline, run by the irq for every received byte. Echoes it and edits the pending line, which moves to the receive buffer once ended by a newline or EOT. A line that does not fit is dropped. 
+
+* @param	c	The received byte.
+*/
+static void line_discipline(char c){
+   rbuf_t *recv_kernel_buffer = (rbuf_t *)recv_buffer;
+
+   if(c == '\b') {
+      if(line_len > 0) {
+         line_len--;
+         uart_put_byte('\b');
+         uart_put_byte(' ');
+         uart_put_byte('\b');
+      }
+      return;
+   }
+
+   if(c == '\r') c = '\n';
+
+   if(c != '\n' && c != EOT) {
+      if(line_len >= LINE_BUFFER_SIZE) return;
+      line_buffer[line_len++] = c;
+      uart_put_byte(c);
+      return;
+   }
+
+   if(c == '\n') uart_put_byte('\n');
+   if(rbuf_space(recv_kernel_buffer) > line_len) {
+      put_n(recv_kernel_buffer, (const char *)line_buffer, line_len);
+      put(recv_kernel_buffer, c);
+      rx_lines++;
+   }
+   line_len = 0;
+}
+
 /**
 * @brief	Handles uart interrupts triggered both by receive or transmit readiness of the uart. 
 */
@@ -128,7 +256,7 @@ void uart_irq_handler(){
    if(transmit_ready) {
       while(sent_byte_count < THRESHOLD) {
          while(!(uart->SR & UART_TXE));
-         if(transmit_kernel_buffer -> n_elems == 0) {
+         if(rbuf_count(transmit_kernel_buffer) == 0) {
            uart->CR1 &= ~UART_TXE;
            break;
          }
@@ -138,6 +266,8 @@ void uart_irq_handler(){
          uart->DR = (unsigned int)transmit_byte;
          sent_byte_count++; 
       }
+      io_ring_pump_tx(); //Refill from pending io ring writes
+      write_tx_wake();
    } 
    
    /* Recieve if ready */
@@ -145,10 +275,14 @@ void uart_irq_handler(){
       while(recv_byte_count < THRESHOLD) {
          if(!(uart->SR & UART_RXNE)) break;
          recv_byte = (char)uart->DR;
-         if(put(recv_kernel_buffer, recv_byte) < 0)
-            break;
          recv_byte_count++; 
+         if(!rx_raw)
+            line_discipline(recv_byte);
+         else if(put(recv_kernel_buffer, recv_byte) < 0)
+            break;
       } 
+      io_ring_pump_rx(); //Hand bytes to pending io ring reads
+      read_rx_wake();
    }
    return;
 }
@@ -162,12 +296,12 @@ void uart_flush(){
    int err;
    
    rbuf_t *transmit_kernel_buffer = (rbuf_t *)transmit_buffer;
-   if(transmit_kernel_buffer->n_elems == 0) {
+   if(rbuf_count(transmit_kernel_buffer) == 0) {
       return;
    }
 
    struct uart_reg_map *uart = UART2_BASE;
-   while(transmit_kernel_buffer->n_elems > 0) {
+   while(rbuf_count(transmit_kernel_buffer) > 0) {
       while(!(uart->SR & UART_TXE));
       transmit_byte = poll(transmit_kernel_buffer, &err);
       uart->DR = (unsigned int)transmit_byte;
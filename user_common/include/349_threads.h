@@ -10,9 +10,30 @@
 #define _SYSCALL_THREAD_H_
 
 #include <stdint.h>
+#include "../../kernel/include/svc_num.h"
+#include "../../kernel/include/svc_batch.h"
+#include "../../kernel/include/io_ring.h"
 
 typedef enum { PER_THREAD = 1, KERNEL_ONLY = 0 } memory_protection_t;
 
+/**
+ * @brief      Scheduling policies. OR'd into the memory_protection argument
+ *             of thread_init, eg - PER_THREAD | SCHED_EDF. PCP if none given.
+ */
+//@{
+#define SCHED_PCP (0 << 4) /**< Fixed priorities with priority ceilings */
+#define SCHED_RMS (1 << 4) /**< Fixed priorities without ceiling checks */
+#define SCHED_EDF (2 << 4) /**< Earliest deadline first, utilization up to 1 */
+//@}
+
+/**
+ * @brief      Admit threads by exact response time analysis instead of the
+ *             UB test under SCHED_PCP or SCHED_RMS. Accepts any set whose
+ *             worst case response times, including mutex blocking, fit
+ *             within the periods.
+ */
+#define SCHED_RTA (1 << 6)
+
 /**
  * @brief      Initialize the thread library
  *
@@ -28,6 +49,7 @@ typedef enum { PER_THREAD = 1, KERNEL_ONLY = 0 } memory_protection_t;
  * @param      memory_protection  If KERNEL_ONLY, then kernel will be
  *                                protected if PER_THREAD, perthread mem
  *                                protection in addition to kernel protection.
+ *                                May be OR'd with a SCHED_ policy.
  * @param      max_mutexes        max number of mutexes created
  *
  * @return     0 on success or -1 on failure
@@ -40,8 +62,8 @@ int thread_init( uint32_t max_threads,
 
 /**
  * @brief      Create a new thread running the given function. The thread will
- *             not be created if the UB test fails, and in that case this function
- *             will return an error.
+ *             not be created if the UB test (or the EDF utilization test under
+ *             SCHED_EDF, or response time analysis under SCHED_RTA) fails, and in that case this function will return an error.
  *
  * @param      fn     Pointer to the function to run in the new thread.
  * @param      prio   Priority of this thread. Lower number are higher
@@ -73,12 +95,20 @@ int thread_create( void ( *fn )( void *vargp ),
 int scheduler_start( uint32_t frequency );
 
 /**
- * @brief      Get the current time.
+ * @brief      Get the current time. Read from the kernel shared page
+ *             without a system call.
  *
  * @return     The time in ticks.
  */
 uint32_t get_time( void );
 
+/**
+ * @brief      Read the processor cycle counter, for benchmarks.
+ *
+ * @return     The cycle count. Always 0 unless built with BENCH=1.
+ */
+uint32_t bench_cycles( void );
+
 /**
  * @brief      Get the effective priority of the current running thread
  *
@@ -88,7 +118,8 @@ uint32_t get_priority( void );
 
 /**
  * @brief      Gets the total elapsed time for the thread (since its first
- *             ever period).
+ *             ever period). Read from the kernel shared page without a
+ *             system call.
  *
  * @return     The time in ticks.
  */
@@ -104,16 +135,26 @@ void wait_until_next_period( void );
  */
 typedef void mutex_t;
 
+/**
+ * @brief      Max_prio of a mutex using priority inheritance instead of
+ *             priority ceilings, for when its users are not known up front.
+ */
+#define MUTEX_INHERIT 0xFFFFFFFF
+
 /**
  * @brief      Initialize a mutex
  *
  *             A user program calls this function to obtain a mutex.
  *
  * @param      max_prio  The maximum priority of a thread which could use
- *                       this mutex.
+ *                       this mutex. MUTEX_INHERIT if unknown, in which case
+ *                       a blocked locker lends its priority to the holder
+ *                       and the mutex is always taken through the kernel.
  *
  * @return     A mutex handle, uniquely referring to this mutex. NULL if
- *             max_mutexes would be exceeded.
+ *             max_mutexes would be exceeded, or under SCHED_RTA if the
+ *             blocking it adds would make the created threads miss their
+ *             deadlines.
  */
 mutex_t *mutex_init( uint32_t max_prio );
 
@@ -121,7 +162,9 @@ mutex_t *mutex_init( uint32_t max_prio );
  * @brief      Lock a mutex
  *
  *             This function will not return until the current thread has
- *             obtained the mutex.
+ *             obtained the mutex. If the mutex is free and max_prio is the
+ *             calling thread's own priority, it is taken in user space
+ *             without a system call.
  *
  * @param      mutex  The mutex to act on.
  */
@@ -134,4 +177,365 @@ void mutex_lock( mutex_t *mutex );
  */
 void mutex_unlock( mutex_t *mutex );
 
+/**
+ * @brief      Type definition for reader-writer lock, opaque to user
+ */
+typedef void rwlock_t;
+
+/**
+ * @brief      Initialize a reader-writer lock
+ *
+ *             The lock follows the priority ceiling protocol like a mutex.
+ *             Written, its ceiling is the higher of the two priorities.
+ *             Read, it is write_prio, so threads of higher priority than
+ *             every writer read concurrently without blocking each other.
+ *             Counts towards max_mutexes.
+ *
+ * @param      read_prio   The maximum priority of a thread which could read.
+ * @param      write_prio  The maximum priority of a thread which could write.
+ *
+ * @return     A lock handle, NULL if max_mutexes would be exceeded.
+ */
+rwlock_t *rwlock_init( uint32_t read_prio, uint32_t write_prio );
+
+/**
+ * @brief      Lock a reader-writer lock for reading
+ *
+ * @param      rwlock  The lock to act on.
+ */
+void rwlock_read_lock( rwlock_t *rwlock );
+
+/**
+ * @brief      Lock a reader-writer lock for writing
+ *
+ * @param      rwlock  The lock to act on.
+ */
+void rwlock_write_lock( rwlock_t *rwlock );
+
+/**
+ * @brief      Unlock a reader-writer lock held for reading or writing
+ *
+ * @param      rwlock  The lock to act on.
+ */
+void rwlock_unlock( rwlock_t *rwlock );
+
+/**
+ * @brief      Type definition for counting semaphore, opaque to user
+ */
+typedef void semaphore_t;
+
+/**
+ * @brief      Initialize a counting semaphore
+ *
+ * @param      count  The initial count.
+ *
+ * @return     A semaphore handle, NULL if no more semaphores can be created.
+ */
+semaphore_t *semaphore_init( uint32_t count );
+
+/**
+ * @brief      Take a semaphore
+ *
+ *             Decrements the count. If it is 0, the calling thread is
+ *             descheduled until another thread gives the semaphore. It uses
+ *             no cpu time while it waits, and its period keeps running.
+ *
+ * @param      sem   The semaphore to act on.
+ *
+ * @return     0 on success, -1 if called from the idle or main thread while
+ *             the count is 0.
+ */
+int semaphore_take( semaphore_t *sem );
+
+/**
+ * @brief      Give a semaphore
+ *
+ *             Wakes the highest priority thread waiting on the semaphore, or
+ *             increments the count if none is waiting. Never blocks.
+ *
+ * @param      sem   The semaphore to act on.
+ */
+void semaphore_give( semaphore_t *sem );
+
+/**
+ * @brief      Type definition for event group, opaque to user
+ */
+typedef void event_group_t;
+
+/**
+ * @brief      Options of event_group_wait, OR'd together.
+ */
+//@{
+#define EVENT_WAIT_ANY 0 /**< Return once any flag of the mask is set */
+#define EVENT_WAIT_ALL 1 /**< Return once every flag of the mask is set */
+#define EVENT_CLEAR 2 /**< Clear the flags of the mask before returning */
+//@}
+
+/**
+ * @brief      Initialize an event group, a 32 bit flag word with all flags
+ *             clear.
+ *
+ * @return     An event group handle, NULL if no more can be created.
+ */
+event_group_t *event_group_init( void );
+
+/**
+ * @brief      Set flags of an event group
+ *
+ *             Wakes every thread whose wait the flags now satisfy. Never
+ *             blocks. The kernel can also set flags from interrupt handlers.
+ *
+ * @param      event  The event group to act on.
+ * @param      flags  Flags to set.
+ *
+ * @return     The flags left set once woken threads have cleared theirs.
+ */
+uint32_t event_group_set( event_group_t *event, uint32_t flags );
+
+/**
+ * @brief      Clear flags of an event group
+ *
+ * @param      event  The event group to act on.
+ * @param      flags  Flags to clear.
+ *
+ * @return     The flags before clearing.
+ */
+uint32_t event_group_clear( event_group_t *event, uint32_t flags );
+
+/**
+ * @brief      Wait on flags of an event group
+ *
+ *             Returns right away if the wait is already satisfied, otherwise
+ *             the calling thread is descheduled until a set satisfies it. It
+ *             uses no cpu time while it waits, and its period keeps running.
+ *
+ * @param      event    The event group to act on.
+ * @param      mask     Flags to wait for.
+ * @param      options  EVENT_WAIT_ANY or EVENT_WAIT_ALL, optionally OR'd
+ *                      with EVENT_CLEAR.
+ *
+ * @return     The flags that satisfied the wait. 0 if mask is 0, or if
+ *             called from the idle or main thread while unsatisfied.
+ */
+uint32_t event_group_wait( event_group_t *event, uint32_t mask, uint32_t options );
+
+/**
+ * @brief      Type definition for message queue, opaque to user
+ */
+typedef void msg_queue_t;
+
+/**
+ * @brief      Initialize a bounded message queue
+ *
+ *             Messages are kept in a pool of fixed size slots owned by the
+ *             caller, eg - a static array, so the queue never allocates.
+ *             Receivers blocked on an empty queue, and senders blocked on a
+ *             full one, are woken highest priority first.
+ *
+ * @param      slots      Slot pool of slot_ct * slot_size bytes.
+ * @param      slot_size  Size of each message in bytes.
+ * @param      slot_ct    Number of slots, at most 32.
+ *
+ * @return     A queue handle, NULL if the arguments are invalid or no more
+ *             queues can be created.
+ */
+msg_queue_t *queue_init( void *slots, uint32_t slot_size, uint32_t slot_ct );
+
+/**
+ * @brief      Copy a message into the queue, waiting while it is full.
+ *
+ * @param      queue  The queue to act on.
+ * @param      msg    Message of slot_size bytes.
+ *
+ * @return     0 on success, -1 if called from the idle or main thread while
+ *             the queue is full.
+ */
+int queue_send( msg_queue_t *queue, const void *msg );
+
+/**
+ * @brief      Copy the oldest message out of the queue, waiting while it
+ *             is empty.
+ *
+ * @param      queue  The queue to act on.
+ * @param      msg    Buffer of slot_size bytes.
+ *
+ * @return     0 on success, -1 if called from the idle or main thread while
+ *             the queue is empty.
+ */
+int queue_recv( msg_queue_t *queue, void *msg );
+
+/**
+ * @brief      Zero copy send, part 1. Take a free slot, waiting while there
+ *             is none, and write the message into it in place.
+ *
+ * @param      queue  The queue to act on.
+ *
+ * @return     The slot, NULL if called from the idle or main thread while
+ *             no slot is free.
+ */
+void *queue_alloc( msg_queue_t *queue );
+
+/**
+ * @brief      Zero copy send, part 2. Pass a slot from queue_alloc on to
+ *             the receivers. The caller must not touch it afterwards.
+ *
+ * @param      queue  The queue to act on.
+ * @param      slot   The slot.
+ *
+ * @return     0 on success, -1 if the slot was not taken by the caller
+ *             with queue_alloc.
+ */
+int queue_send_slot( msg_queue_t *queue, void *slot );
+
+/**
+ * @brief      Zero copy receive, part 1. Take the oldest sent slot, waiting
+ *             while there is none, and read the message in place.
+ *
+ * @param      queue  The queue to act on.
+ *
+ * @return     The slot, NULL if called from the idle or main thread while
+ *             the queue is empty.
+ */
+void *queue_recv_slot( msg_queue_t *queue );
+
+/**
+ * @brief      Zero copy receive, part 2. Give a slot from queue_recv_slot
+ *             back to the senders. The caller must not touch it afterwards.
+ *
+ * @param      queue  The queue to act on.
+ * @param      slot   The slot.
+ *
+ * @return     0 on success, -1 if the slot was not taken by the caller
+ *             with queue_recv_slot.
+ */
+int queue_release( msg_queue_t *queue, void *slot );
+
+/**
+ * @brief      Type definition of one system call in a batch, see
+ *             svc_batch.h
+ */
+typedef svc_op_t batch_op_t;
+
+/**
+ * @brief      Fill in a batch operation.
+ *
+ * @param      op   The operation.
+ * @param      svc  Svc number of the call, one of the SVC_ numbers.
+ * @param      a0   First argument.
+ * @param      a1   Second argument.
+ * @param      a2   Third argument.
+ */
+void batch_op( batch_op_t *op, uint32_t svc, uint32_t a0, uint32_t a1, uint32_t a2 );
+
+/**
+ * @brief      Fill in a batch operation locking a mutex. Batched locks
+ *             always go through the kernel.
+ *
+ * @param      op     The operation.
+ * @param      mutex  The mutex to lock.
+ */
+void batch_mutex_lock( batch_op_t *op, mutex_t *mutex );
+
+/**
+ * @brief      Fill in a batch operation unlocking a mutex.
+ *
+ * @param      op     The operation.
+ * @param      mutex  The mutex to unlock.
+ */
+void batch_mutex_unlock( batch_op_t *op, mutex_t *mutex );
+
+/**
+ * @brief      Run several system calls in order for the cost of one.
+ *
+ *             Stops after a call that made the thread wait or block, such
+ *             as a contended lock or wait_until_next_period. The calls
+ *             after it were issued for cpu time the thread no longer has
+ *             and should be submitted again if still wanted.
+ *
+ * @param      ops  The operations, each result is written back.
+ * @param      n    Number of operations.
+ *
+ * @return     Number of operations completed, -1 if n is 0 or ops is not
+ *             memory the caller can write.
+ */
+int syscall_batch( batch_op_t *ops, uint32_t n );
+
+/**
+ * @brief      Input modes of read_mode.
+ */
+//@{
+#define READ_CANONICAL 0 /**< Lines are echoed and edited by the kernel, a read returns one line*/
+#define READ_RAW 1 /**< Bytes are handed over as they arrive, for binary protocols*/
+//@}
+
+/**
+ * @brief      Select how stdin is read. Input not read yet is discarded.
+ *
+ *             In either mode a reading thread sleeps until its input is
+ *             ready, a complete line or, in raw mode, the requested bytes.
+ *
+ * @param      mode  READ_CANONICAL or READ_RAW.
+ *
+ * @return     0 on success, -1 for an unknown mode.
+ */
+int read_mode( int mode );
+
+/**
+ * @brief      Register asynchronous I/O rings, see io_ring.h
+ *
+ * @param      ring  The rings, in memory the caller can write. The kernel
+ *                   uses them until io_ring_exit or the caller is killed.
+ * @param      file  STDOUT_FILENO for a ring of writes, STDIN_FILENO for
+ *                   a ring of reads.
+ *
+ * @return     0 on success, -1 if the file is not supported, the ring is
+ *             already registered or too many rings are registered.
+ */
+int io_ring_init( io_ring_t *ring, int file );
+
+/**
+ * @brief      Post a request on a ring. It only starts once submitted.
+ *
+ * @param      ring  The rings.
+ * @param      buf   Buffer to write from or read into. Must stay valid
+ *                   until the request completes. A buffer the caller
+ *                   cannot access completes with -1.
+ * @param      len   Bytes to write, or the most to read.
+ * @param      tag   Returned with the completion.
+ *
+ * @return     0 on success, -1 if the submission ring is full.
+ */
+int io_ring_post( io_ring_t *ring, void *buf, uint32_t len, uint32_t tag );
+
+/**
+ * @brief      Start on the posted requests without waiting for them. The
+ *             kernel carries them on from the uart interrupt.
+ *
+ * @param      ring  The rings.
+ *
+ * @return     Number of requests still in progress, -1 if the ring is not
+ *             registered.
+ */
+int io_ring_submit( io_ring_t *ring );
+
+/**
+ * @brief      Take the oldest completion off a ring, if any.
+ *
+ * @param      ring  The rings.
+ * @param[out] cqe   Filled with the completion.
+ *
+ * @return     0 on success, -1 if nothing completed yet.
+ */
+int io_ring_reap( io_ring_t *ring, io_cqe_t *cqe );
+
+/**
+ * @brief      Unregister rings. Requests still in progress are abandoned,
+ *             the memory of the rings and their buffers may be reused.
+ *
+ * @param      ring  The rings.
+ *
+ * @return     0 on success, -1 if the caller did not register them.
+ */
+int io_ring_exit( io_ring_t *ring );
+
 #endif /* _SYSCALL_THREAD_H_ */
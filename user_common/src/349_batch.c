@@ -0,0 +1,17 @@
+/** @file 349_batch.c
+ *
+ *  @brief  Helpers to build syscall batches. The batch itself is a single
+ *          SVC, see syscall_batch.
+ */
+
+#include <349_threads.h>
+
+void batch_op( batch_op_t *op, uint32_t svc, uint32_t a0, uint32_t a1, uint32_t a2 ) {
+  op->svc = svc;
+  op->args[0] = a0;
+  op->args[1] = a1;
+  op->args[2] = a2;
+  op->args[3] = 0;
+  op->args[4] = 0;
+  op->result = 0;
+}
@@ -0,0 +1,49 @@
+/** @file 349_io.c
+ *
+ *  @brief  User side of the asynchronous I/O rings. Posting and reaping are
+ *          plain memory accesses, only registering and submitting enter the
+ *          kernel.
+ */
+
+#include <349_threads.h>
+
+/** @brief Keeps the compiler from moving ring accesses across an index update */
+#define compiler_barrier() __asm volatile ( "" ::: "memory" )
+
+/** @brief SVC stub of the kernel registration */
+int _io_ring_init( io_ring_t *ring, int file );
+
+int io_ring_init( io_ring_t *ring, int file ) {
+  ring->sq_head = 0;
+  ring->sq_tail = 0;
+  ring->cq_head = 0;
+  ring->cq_tail = 0;
+  return _io_ring_init( ring, file );
+}
+
+int io_ring_post( io_ring_t *ring, void *buf, uint32_t len, uint32_t tag ) {
+  uint32_t tail = ring->sq_tail;
+  if ( tail - ring->sq_head >= IO_RING_ENTRIES ) return -1;
+
+  io_sqe_t *sqe = &ring->sq[tail & IO_RING_MASK];
+  sqe->buf = ( uint32_t )buf;
+  sqe->len = len;
+  sqe->tag = tag;
+
+  // The kernel may look at the ring from any interrupt
+  compiler_barrier();
+  ring->sq_tail = tail + 1;
+  return 0;
+}
+
+int io_ring_reap( io_ring_t *ring, io_cqe_t *cqe ) {
+  uint32_t head = ring->cq_head;
+  if ( head == ring->cq_tail ) return -1;
+
+  *cqe = ring->cq[head & IO_RING_MASK];
+
+  // Read out before the kernel may reuse the entry
+  compiler_barrier();
+  ring->cq_head = head + 1;
+  return 0;
+}
@@ -0,0 +1,135 @@
+/** @file 349_mutex.c
+ *
+ *  @brief  User space mutex fast path. Uncontended locks whose ceiling is the
+ *          locking thread's priority are taken and released with LDREX/STREX
+ *          on a lock word. Everything else goes to the kernel through SVC.
+ */
+
+#include "../../kernel/include/mutex_fast.h"
+#include <349_threads.h>
+#include <349_lib.h>
+#include <stddef.h>
+
+/** @brief Force inlining of the exclusive access helpers */
+#define intrinsic __attribute__( ( always_inline ) ) static inline
+
+/**
+ * @brief      User side of a mutex, what mutex_t points to.
+ */
+typedef struct {
+  volatile uint32_t lock; /**< Lock word, see mutex_fast.h*/
+  uint32_t ceiling; /**< Max_prio the mutex was created with*/
+  void *kmutex; /**< Kernel handle for the SVC slow path*/
+} umutex_t;
+
+/** @brief Backing storage for mutex_init */
+static umutex_t mutex_pool[MAX_MUTEXES];
+
+/** @brief Number of mutexes handed out */
+static uint32_t mutex_ct = 0;
+
+/** @brief Running thread and fast path permission, published by the kernel */
+static mutex_fast_t fast_state = { .fast_prio = FAST_PRIO_NONE };
+
+/** @brief SVC stubs of the kernel mutex calls */
+//@{
+void *_mutex_init_fast( uint32_t max_prio, volatile uint32_t *lock_word, mutex_fast_t *fast );
+void _mutex_lock( void *kmutex );
+void _mutex_unlock( void *kmutex );
+//@}
+
+/**
+ * @brief      Loads a word and marks it for exclusive access.
+ *
+ * @param      addr  The address
+ *
+ * @return     The loaded value.
+ */
+intrinsic uint32_t load_exclusive_register( volatile uint32_t *addr ) {
+  uint32_t result;
+
+  __asm volatile ( "ldrex %0, [%1]" : "=r" ( result ) : "r" ( addr ) );
+  return( result );
+}
+
+/**
+ * @brief      Stores a word if nothing touched it since load_exclusive_register.
+ *             Any exception in between makes the store fail.
+ *
+ * @param      addr  The address
+ * @param[in]  val   Value to store to address.
+ *
+ * @return     0 if successful else 1.
+ */
+intrinsic uint32_t store_exclusive_register( volatile uint32_t *addr, uint32_t val ) {
+  uint32_t result;
+
+  __asm volatile ( "strex %0, %1, [%2]" : "=&r" ( result ) : "r" ( val ), "r" ( addr ) : "memory" );
+  return( result );
+}
+
+/**
+ * @brief      Atomically adds to the fast path lock count of a thread. The
+ *             kernel lowers it when it adopts locks.
+ */
+static void add_held( uint32_t thread, int32_t n ) {
+  volatile uint32_t *held = &fast_state.held[thread];
+  uint32_t val;
+
+  do {
+    val = load_exclusive_register( held );
+  } while ( store_exclusive_register( held, val + n ) );
+}
+
+mutex_t *mutex_init( uint32_t max_prio ) {
+  if ( mutex_ct >= MAX_MUTEXES ) return NULL;
+
+  umutex_t *mutex = &mutex_pool[mutex_ct];
+  mutex->ceiling = max_prio;
+  mutex->kmutex = _mutex_init_fast( max_prio, &mutex->lock, &fast_state );
+  if ( mutex->kmutex == NULL ) return NULL;
+
+  mutex_ct++;
+  return ( mutex_t * )mutex;
+}
+
+void mutex_lock( mutex_t *handle ) {
+  umutex_t *mutex = ( umutex_t * )handle;
+  uint32_t thread = fast_state.running_thread;
+
+  // Counted first, so a kernel that adopts locks never finds one it missed
+  add_held( thread, 1 );
+
+  while ( 1 ) {
+    uint32_t word = load_exclusive_register( &mutex->lock );
+    if ( word != LOCK_FREE || fast_state.fast_prio != mutex->ceiling ) break;
+    if ( !store_exclusive_register( &mutex->lock, LOCK_OWNER( thread ) ) ) return;
+  }
+
+  add_held( thread, -1 );
+  _mutex_lock( mutex->kmutex );
+}
+
+void mutex_unlock( mutex_t *handle ) {
+  umutex_t *mutex = ( umutex_t * )handle;
+  uint32_t thread = fast_state.running_thread;
+
+  while ( 1 ) {
+    uint32_t word = load_exclusive_register( &mutex->lock );
+    if ( word != LOCK_OWNER( thread ) ) break; // Kernel tracked
+    if ( !store_exclusive_register( &mutex->lock, LOCK_FREE ) ) {
+      add_held( thread, -1 );
+      return;
+    }
+  }
+
+  _mutex_unlock( mutex->kmutex );
+}
+
+void batch_mutex_lock( batch_op_t *op, mutex_t *handle ) {
+  batch_op( op, SVC_MUT_LOK, ( uint32_t )( ( umutex_t * )handle )->kmutex, 0, 0 );
+}
+
+void batch_mutex_unlock( batch_op_t *op, mutex_t *handle ) {
+  batch_op( op, SVC_MUT_ULK, ( uint32_t )( ( umutex_t * )handle )->kmutex, 0, 0 );
+}
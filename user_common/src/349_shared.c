@@ -0,0 +1,27 @@
+/** @file 349_shared.c
+ *
+ *  @brief  Time queries answered from the kernel shared page instead of
+ *          through SVC. The page is mapped read only, so these are plain
+ *          loads.
+ */
+
+#include "../../kernel/include/kernel_shared.h"
+#include <349_threads.h>
+
+uint32_t get_time( void ) {
+  return KERNEL_SHARED->sys_tick_ct;
+}
+
+uint32_t thread_time( void ) {
+  volatile kshared_t *shared = KERNEL_SHARED;
+  uint32_t thread;
+  uint32_t time;
+
+  // A switch between the two loads would pair one thread's time with another
+  do {
+    thread = shared->running_thread;
+    time = shared->thread_time[thread];
+  } while ( thread != shared->running_thread );
+
+  return time;
+}
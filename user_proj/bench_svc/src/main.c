@@ -0,0 +1,121 @@
+/**
+ * @file   main.c
+ *
+ * @brief  Benchmarks syscall entry in DWT cycles per call. get_priority()
+ *         through the legacy svc abi, where the kernel decodes the number
+ *         from the svc instruction in flash, against the v2 abi stubs,
+ *         which carry it in r12, and get_time() read from the kernel shared
+ *         page with no svc at all. Each runs CALLS times between two reads
+ *         of the cycle counter, less the cost of the empty loop. Needs a
+ *         BENCH=1 build for the counter to run.
+ *
+ * @author Kunal Barde, Nick Toldalagi
+ */
+
+#include <349_lib.h>
+#include <349_threads.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** @brief thread user space stack size - 1KB */
+#define USR_STACK_WORDS 256
+#define NUM_THREADS 1
+#define NUM_MUTEXES 0
+#define CLOCK_FREQUENCY 1000
+
+/** @brief calls timed per variant */
+#define CALLS 1000
+
+/** @brief svc number of get_priority(), SVC_PRIORITY in svc_num.h */
+#define SVC_PRIORITY_NUM 19
+/** @brief svc number of get_time(), SVC_TIME in svc_num.h */
+#define SVC_TIME_NUM 17
+
+/** @brief Keeps the compiler from folding the empty loop away */
+#define compiler_barrier() __asm volatile ( "" ::: "memory" )
+
+volatile uint32_t loop_cycles = 0;
+volatile uint32_t legacy_cycles = 0;
+volatile uint32_t v2_cycles = 0;
+volatile uint32_t shared_cycles = 0;
+
+volatile uint32_t legacy_prio = 0;
+volatile uint32_t v2_prio = 0;
+volatile uint32_t shared_time = 0;
+
+/**
+ * @brief      get_priority() through the legacy abi. r12 is left holding
+ *             the get_time() number, which the kernel must ignore.
+ */
+static uint32_t legacy_get_priority( void ) {
+  register uint32_t r0 __asm__( "r0" );
+  __asm__ volatile( "mov r12, %2\n\tsvc %1"
+                    : "=r"( r0 )
+                    : "I"( SVC_PRIORITY_NUM ), "I"( SVC_TIME_NUM )
+                    : "r1", "r2", "r3", "r12", "memory" );
+  return r0;
+}
+
+/**
+ * @brief      Cycles per iteration of a timed loop, less the empty loop.
+ */
+static uint32_t per_call( uint32_t start, uint32_t end ) {
+  uint32_t cycles = ( end - start ) / CALLS;
+  return cycles > loop_cycles ? cycles - loop_cycles : 0;
+}
+
+void bench( UNUSED void *vargp ) {
+  uint32_t start = bench_cycles();
+  for ( int i = 0; i < CALLS; i++ ) compiler_barrier();
+  loop_cycles = ( bench_cycles() - start ) / CALLS;
+
+  start = bench_cycles();
+  for ( int i = 0; i < CALLS; i++ ) legacy_prio = legacy_get_priority();
+  legacy_cycles = per_call( start, bench_cycles() );
+
+  start = bench_cycles();
+  for ( int i = 0; i < CALLS; i++ ) v2_prio = get_priority();
+  v2_cycles = per_call( start, bench_cycles() );
+
+  start = bench_cycles();
+  for ( int i = 0; i < CALLS; i++ ) shared_time = get_time();
+  shared_cycles = per_call( start, bench_cycles() );
+}
+
+int main( void ) {
+
+  printf( "In user mode.\n" );
+
+  ABORT_ON_ERROR( thread_init( NUM_THREADS, USR_STACK_WORDS, NULL, KERNEL_ONLY, NUM_MUTEXES ) );
+  ABORT_ON_ERROR( thread_create( &bench, 0, 500, 1000, NULL ) );
+
+  printf( "Starting scheduler...\n" );
+
+  ABORT_ON_ERROR( scheduler_start( CLOCK_FREQUENCY ) );
+
+  printf( "get_priority: legacy %lu cycles, v2 %lu cycles per call\n",
+          ( unsigned long )legacy_cycles, ( unsigned long )v2_cycles );
+  printf( "get_time: shared page %lu cycles per call\n",
+          ( unsigned long )shared_cycles );
+
+  if ( legacy_cycles == 0 ) {
+    printf( "Test failed, no cycle counts, build with BENCH=1\n" );
+    return 1;
+  }
+
+  if ( legacy_prio != v2_prio ) {
+    printf( "Test failed, legacy abi returned %lu, v2 abi %lu\n",
+            ( unsigned long )legacy_prio, ( unsigned long )v2_prio );
+    return 1;
+  }
+
+  if ( v2_cycles < legacy_cycles && shared_cycles < v2_cycles ) {
+    printf( "Test passed!\n" );
+  } else {
+    printf( "Test failed, queries did not get cheaper\n" );
+    return 1;
+  }
+
+  return 0;
+}
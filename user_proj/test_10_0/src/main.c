@@ -0,0 +1,64 @@
+/**
+ * @file   main.c
+ *
+ * @brief  Tests EDF admission. A task set rejected by the UB test is
+ *         admitted up to a total utilization of exactly 1.
+ *
+ * @author Kunal Barde, Nick Toldalagi
+ */
+
+#include <349_lib.h>
+#include <349_threads.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** @brief thread user space stack size - 1KB */
+#define USR_STACK_WORDS 256
+#define NUM_THREADS 4
+#define NUM_MUTEXES 0
+#define CLOCK_FREQUENCY 1000
+
+void thread_fn( void *vargp ) {
+  int cnt = 0;
+  int num = ( int )vargp;
+  while ( cnt < 2 ) {
+    print_num_status_cnt( num, cnt++ );
+    wait_until_next_period();
+  }
+  if ( num == 2 ) printf( "Test passed!\n" );
+  while ( 1 ) wait_until_next_period();
+}
+
+int main( void ) {
+
+  printf( "In user mode.\n" );
+
+  ABORT_ON_ERROR( thread_init( NUM_THREADS, USR_STACK_WORDS, NULL, KERNEL_ONLY | SCHED_EDF, NUM_MUTEXES ) );
+
+  for ( int i = 0; i < 2; i++ ) {
+    ABORT_ON_ERROR( thread_create( &thread_fn, i, 50, 200, ( void * )i ),
+      "Thread %d\n", i
+    );
+  }
+  int stat, try_C;
+  for ( try_C = 1000; try_C > 0; try_C -= 100 ) {
+    stat = thread_create( &thread_fn, 2, try_C, 1000, ( void * )2 );
+    if ( stat == 0 ) break;
+  }
+  if ( try_C != 500 ) {
+    printf ( "Test failed, thread 2. C = %d\n", try_C );
+    return 1;
+  }
+
+  if ( thread_create( &thread_fn, 3, 25, 5000, ( void * )3 ) == 0 ) {
+    printf ( "Test failed, thread 3 admitted past full utilization\n" );
+    return 1;
+  }
+
+  printf( "Starting scheduler...\n" );
+
+  ABORT_ON_ERROR( scheduler_start( CLOCK_FREQUENCY ) );
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file   main.c
+ *
+ * @brief  Tests counting semaphores. A high priority consumer blocks on a
+ *         semaphore and must run as soon as a lower priority producer
+ *         gives it, without polling.
+ *
+ * @author Kunal Barde, Nick Toldalagi
+ */
+
+#include <349_lib.h>
+#include <349_threads.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** @brief thread user space stack size - 1KB */
+#define USR_STACK_WORDS 256
+#define NUM_THREADS 2
+#define NUM_MUTEXES 0
+#define CLOCK_FREQUENCY 1000
+
+/** @brief items handed from producer to consumer */
+#define ITEMS 4
+
+semaphore_t *items;
+volatile int produced = 0;
+volatile int consumed = 0;
+volatile int failed = 0;
+
+void consumer( UNUSED void *vargp ) {
+  while ( consumed < ITEMS ) {
+    if ( semaphore_take( items ) ) failed = 1;
+    consumed++;
+    print_num_status_cnt( 0, consumed );
+    if ( consumed != produced ) failed = 1; // Woken late or spuriously
+  }
+}
+
+void producer( UNUSED void *vargp ) {
+  while ( produced < ITEMS ) {
+    produced++;
+    semaphore_give( items );
+    print_num_status_cnt( 1, produced );
+    wait_until_next_period();
+  }
+}
+
+int main( void ) {
+
+  printf( "In user mode.\n" );
+
+  ABORT_ON_ERROR( thread_init( NUM_THREADS, USR_STACK_WORDS, NULL, KERNEL_ONLY, NUM_MUTEXES ) );
+
+  items = semaphore_init( 0 );
+  if ( items == NULL ) {
+    printf( "Test failed, semaphore_init\n" );
+    return 1;
+  }
+
+  ABORT_ON_ERROR( thread_create( &consumer, 0, 50, 100, NULL ) );
+  ABORT_ON_ERROR( thread_create( &producer, 1, 50, 300, NULL ) );
+
+  printf( "Starting scheduler...\n" );
+
+  ABORT_ON_ERROR( scheduler_start( CLOCK_FREQUENCY ) );
+
+  if ( !failed && consumed == ITEMS && produced == ITEMS ) {
+    printf( "Test passed!\n" );
+  } else {
+    printf( "Test failed. produced %d consumed %d\n", produced, consumed );
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file   main.c
+ *
+ * @brief  Tests message queues. A three stage pipeline passes samples
+ *         through a copying queue and then a zero copy queue, which must
+ *         deliver every message once and in order.
+ *
+ * @author Kunal Barde, Nick Toldalagi
+ */
+
+#include <349_lib.h>
+#include <349_threads.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** @brief thread user space stack size - 1KB */
+#define USR_STACK_WORDS 256
+#define NUM_THREADS 3
+#define NUM_MUTEXES 0
+#define CLOCK_FREQUENCY 1000
+
+/** @brief slots in each queue, fewer than the messages sent so senders block */
+#define SLOTS 2
+/** @brief messages sent through the pipeline */
+#define MESSAGES 6
+
+/** @brief message passed down the pipeline */
+typedef struct {
+  int seq;
+  int value;
+} sample_t;
+
+sample_t raw_slots[ SLOTS ];
+sample_t filtered_slots[ SLOTS ];
+msg_queue_t *raw;
+msg_queue_t *filtered;
+volatile int received = 0;
+volatile int failed = 0;
+
+void sink( UNUSED void *vargp ) {
+  while ( received < MESSAGES ) {
+    sample_t *sample = queue_recv_slot( filtered );
+    if ( sample == NULL || sample->seq != received || sample->value != 2 * received ) failed = 1;
+    received++;
+    print_num_status_cnt( 0, received );
+    if ( queue_release( filtered, sample ) ) failed = 1;
+  }
+}
+
+void filter( UNUSED void *vargp ) {
+  sample_t in;
+  for ( int i = 0; i < MESSAGES; i++ ) {
+    if ( queue_recv( raw, &in ) ) failed = 1;
+    sample_t *out = queue_alloc( filtered );
+    if ( out == NULL ) {
+      failed = 1;
+      return;
+    }
+    out->seq = in.seq;
+    out->value = 2 * in.value;
+    if ( queue_send_slot( filtered, out ) ) failed = 1;
+    print_num_status_cnt( 1, i );
+  }
+}
+
+void source( UNUSED void *vargp ) {
+  for ( int i = 0; i < MESSAGES; i++ ) {
+    sample_t sample = { i, i };
+    if ( queue_send( raw, &sample ) ) failed = 1;
+    print_num_status_cnt( 2, i );
+  }
+}
+
+int main( void ) {
+
+  printf( "In user mode.\n" );
+
+  ABORT_ON_ERROR( thread_init( NUM_THREADS, USR_STACK_WORDS, NULL, KERNEL_ONLY, NUM_MUTEXES ) );
+
+  raw = queue_init( raw_slots, sizeof( sample_t ), SLOTS );
+  filtered = queue_init( filtered_slots, sizeof( sample_t ), SLOTS );
+  if ( raw == NULL || filtered == NULL ) {
+    printf( "Test failed, queue_init\n" );
+    return 1;
+  }
+
+  ABORT_ON_ERROR( thread_create( &sink, 0, 50, 200, NULL ) );
+  ABORT_ON_ERROR( thread_create( &filter, 1, 50, 200, NULL ) );
+  ABORT_ON_ERROR( thread_create( &source, 2, 50, 200, NULL ) );
+
+  printf( "Starting scheduler...\n" );
+
+  ABORT_ON_ERROR( scheduler_start( CLOCK_FREQUENCY ) );
+
+  if ( !failed && received == MESSAGES ) {
+    printf( "Test passed!\n" );
+  } else {
+    printf( "Test failed. received %d\n", received );
+    return 1;
+  }
+
+  return 0;
+}
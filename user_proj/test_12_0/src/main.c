@@ -0,0 +1,81 @@
+/**
+ * @file   main.c
+ *
+ * @brief  Tests syscall batching. Each period a thread locks a mutex,
+ *         writes, unlocks and waits for its next period in one batch. The
+ *         batch must complete every operation and stop at the wait, and
+ *         the thread must resume in its next period.
+ *
+ * @author Kunal Barde, Nick Toldalagi
+ */
+
+#include <349_lib.h>
+#include <349_threads.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** @brief thread user space stack size - 1KB */
+#define USR_STACK_WORDS 256
+#define NUM_THREADS 1
+#define NUM_MUTEXES 1
+#define CLOCK_FREQUENCY 1000
+
+/** @brief periods the batch is run for */
+#define PERIODS 4
+/** @brief operations in the batch */
+#define OPS 4
+
+/** @brief bytes written by the batch */
+#define MSG "batch\n"
+
+mutex_t *lock;
+volatile int runs = 0;
+volatile int failed = 0;
+
+void batcher( UNUSED void *vargp ) {
+  batch_op_t ops[OPS];
+
+  batch_mutex_lock( &ops[0], lock );
+  batch_op( &ops[1], SVC_WRITE, STDOUT_FILENO, ( uint32_t )MSG, sizeof( MSG ) - 1 );
+  batch_mutex_unlock( &ops[2], lock );
+  batch_op( &ops[3], SVC_WAIT, 0, 0, 0 );
+
+  while ( runs < PERIODS ) {
+    uint32_t start = get_time();
+
+    if ( syscall_batch( ops, OPS ) != OPS ) failed = 1;
+    if ( ops[1].result != sizeof( MSG ) - 1 ) failed = 1;
+    if ( get_time() == start ) failed = 1; // Did not wait for the next period
+
+    runs++;
+  }
+}
+
+int main( void ) {
+
+  printf( "In user mode.\n" );
+
+  ABORT_ON_ERROR( thread_init( NUM_THREADS, USR_STACK_WORDS, NULL, KERNEL_ONLY, NUM_MUTEXES ) );
+
+  lock = mutex_init( 0 );
+  if ( lock == NULL ) {
+    printf( "Test failed, mutex_init\n" );
+    return 1;
+  }
+
+  ABORT_ON_ERROR( thread_create( &batcher, 0, 50, 100, NULL ) );
+
+  printf( "Starting scheduler...\n" );
+
+  ABORT_ON_ERROR( scheduler_start( CLOCK_FREQUENCY ) );
+
+  if ( !failed && runs == PERIODS ) {
+    printf( "Test passed!\n" );
+  } else {
+    printf( "Test failed. runs %d\n", runs );
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file   main.c
+ *
+ * @brief  Tests asynchronous writes through an io ring. Each period a
+ *         thread reaps the writes completed since the last one, posts a
+ *         new one and goes on without waiting for the uart. Every write
+ *         must complete in full and in order.
+ *
+ * @author Kunal Barde, Nick Toldalagi
+ */
+
+#include <349_lib.h>
+#include <349_threads.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** @brief thread user space stack size - 1KB */
+#define USR_STACK_WORDS 256
+#define NUM_THREADS 1
+#define NUM_MUTEXES 0
+#define CLOCK_FREQUENCY 1000
+
+/** @brief writes posted */
+#define WRITES 6
+
+/** @brief bytes each write sends */
+#define MSG "asynchronous write through an io ring\n"
+
+io_ring_t ring;
+volatile uint32_t posted = 0;
+volatile uint32_t completed = 0;
+volatile int failed = 0;
+
+/**
+ * @brief      Checks every completion posted so far.
+ */
+void reap( void ) {
+  io_cqe_t cqe;
+
+  while ( !io_ring_reap( &ring, &cqe ) ) {
+    if ( cqe.tag != completed || cqe.result != sizeof( MSG ) - 1 ) failed = 1;
+    completed++;
+  }
+}
+
+void writer( UNUSED void *vargp ) {
+  while ( completed < WRITES ) {
+    reap();
+
+    if ( posted < WRITES ) {
+      if ( io_ring_post( &ring, MSG, sizeof( MSG ) - 1, posted ) ) failed = 1;
+      posted++;
+      if ( io_ring_submit( &ring ) < 0 ) failed = 1;
+    }
+
+    wait_until_next_period();
+  }
+}
+
+int main( void ) {
+
+  printf( "In user mode.\n" );
+
+  ABORT_ON_ERROR( thread_init( NUM_THREADS, USR_STACK_WORDS, NULL, KERNEL_ONLY, NUM_MUTEXES ) );
+
+  if ( io_ring_init( &ring, STDOUT_FILENO ) ) {
+    printf( "Test failed, io_ring_init\n" );
+    return 1;
+  }
+
+  ABORT_ON_ERROR( thread_create( &writer, 0, 10, 50, NULL ) );
+
+  printf( "Starting scheduler...\n" );
+
+  ABORT_ON_ERROR( scheduler_start( CLOCK_FREQUENCY ) );
+
+  if ( !failed && completed == WRITES ) {
+    printf( "Test passed!\n" );
+  } else {
+    printf( "Test failed. completed %lu\n", ( unsigned long )completed );
+    return 1;
+  }
+
+  return 0;
+}